@@ -0,0 +1,182 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-archive.hpp
+/// @brief tnyosc append-only packet archive
+/// @author Toshiro Yamada
+///
+/// An archive stores raw OSC packets together with an index so that the
+/// messages for an address pattern and time range can be found without
+/// decoding the whole log. An archive named "show" consists of five files:
+///
+///   - show.dat: the raw packets, back to back
+///   - show.idx: one ArchiveIndexEntry per message, in arrival order
+///   - show.adr: the distinct addresses, null-terminated, in order of first
+///     appearance; the n-th address has id n
+///   - show.ckp: one ArchiveCheckpoint per kArchiveCheckpointInterval entries
+///   - show.blk: for each checkpoint, the sorted ids of the addresses in its
+///     block
+///
+/// All files are append-only and written in host byte order. ArchiveReader
+/// maps them into memory and answers queries by matching the pattern once per
+/// distinct address, skipping checkpoint blocks outside the time range or
+/// without a matching address, and returning pointers to the original
+/// message bytes. Only the index entries of the remaining blocks are read.
+#ifndef __TNY_OSC_ARCHIVE__
+#define __TNY_OSC_ARCHIVE__
+
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace tnyosc {
+
+/// Number of index entries summarized by one checkpoint.
+static const uint32_t kArchiveCheckpointInterval = 1024;
+
+// index entry for one message
+struct ArchiveIndexEntry {
+  uint64_t time; // NTP time: bundle timetag, or receive time if immediate
+  uint64_t offset; // offset of the message in the .dat file
+  uint32_t size; // size of the message
+  uint32_t address_id; // position of the address in the .adr file
+};
+
+// time range and addresses of a block of kArchiveCheckpointInterval index
+// entries
+struct ArchiveCheckpoint {
+  uint64_t min_time;
+  uint64_t max_time;
+  uint64_t addresses; // index of the block's first address id in .blk
+  uint32_t num_addresses; // distinct addresses in the block
+  uint32_t reserved;
+};
+
+// a message found by ArchiveReader::query
+struct ArchiveRecord {
+  uint64_t time; // NTP time, as in ArchiveIndexEntry
+  const char* address;
+  const char* data; // raw message, valid while the reader is open
+  size_t size;
+};
+
+class ArchiveWriter {
+ public:
+  ArchiveWriter();
+  /// Closes the archive if it is open.
+  ~ArchiveWriter();
+
+  /// Opens the archive files named base.*, creating them if needed. New
+  /// packets are appended after any existing ones.
+  bool open(const std::string& base);
+
+  /// Flushes and closes the archive files.
+  void close();
+
+  /// Appends a raw packet. Each message in it is indexed at the timetag of
+  /// its enclosing bundle, or at receive_time if it is not in a bundle or the
+  /// timetag is immediate.
+  ///
+  /// @return false if the packet is malformed or a write failed.
+  bool append(const char* data, size_t size,
+      uint64_t receive_time=get_current_ntp_time());
+
+  /// Writes buffered data to the files.
+  bool flush();
+
+ private:
+  ArchiveWriter(const ArchiveWriter&);
+  ArchiveWriter& operator=(const ArchiveWriter&);
+
+  uint32_t intern(const char* address);
+
+  FILE* data_file_;
+  FILE* index_file_;
+  FILE* address_file_;
+  FILE* checkpoint_file_;
+  FILE* block_file_;
+  uint64_t data_size_; // current size of the .dat file
+  uint64_t num_entries_;
+  uint64_t num_block_ids_; // address ids in the .blk file
+  std::map<std::string, uint32_t> address_ids_;
+  ArchiveCheckpoint block_; // time range of the current partial block
+  std::vector<uint32_t> block_ids_; // address ids of the partial block
+};
+
+class ArchiveReader {
+ public:
+  ArchiveReader();
+  /// Closes the archive if it is open.
+  ~ArchiveReader();
+
+  /// Maps the archive files named base.* into memory. Packets appended
+  /// later are not visible until the archive is opened again.
+  bool open(const std::string& base);
+
+  /// Unmaps the archive. Records returned by query become invalid.
+  void close();
+
+  /// Returns the number of indexed messages.
+  size_t size() const { return num_entries_; }
+
+  /// Returns the distinct addresses in the archive.
+  const std::vector<std::string>& addresses() const { return addresses_; }
+
+  /// Appends to records every message whose address matches pattern (see
+  /// Dispatcher::pattern_match) and whose time t satisfies
+  /// start <= t <= end, in arrival order.
+  ///
+  /// @return Number of records appended.
+  size_t query(const std::string& pattern, uint64_t start, uint64_t end,
+      std::vector<ArchiveRecord>& records) const;
+
+ private:
+  ArchiveReader(const ArchiveReader&);
+  ArchiveReader& operator=(const ArchiveReader&);
+
+  struct Mapping {
+    void* address;
+    size_t size;
+  };
+  static bool map_file(const std::string& path, Mapping& mapping);
+  static void unmap_file(Mapping& mapping);
+
+  Mapping data_;
+  Mapping index_;
+  Mapping checkpoints_;
+  Mapping blocks_;
+  size_t num_entries_;
+  size_t num_checkpoints_;
+  std::vector<std::string> addresses_;
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_ARCHIVE__
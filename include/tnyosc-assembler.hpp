@@ -0,0 +1,107 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-assembler.hpp
+/// @brief tnyosc lock-free multi-producer bundle assembler
+/// @author Toshiro Yamada
+///
+/// BundleAssembler lets several threads add messages to the bundle that goes
+/// out at the next tick without taking a lock. Producers reserve space in a
+/// preallocated buffer with a single atomic add and encode their element in
+/// place; a flusher thread seals the buffer, writes the bundle header with a
+/// timetag and switches producers to a second buffer.
+///
+/// Each buffer has one 64-bit state word: the low 32 bits are the bytes
+/// reserved, bits 32 to 62 count producers still writing, and bit 63 marks a
+/// sealed buffer. A reservation adds both the size and one writer in the same
+/// atomic add, and commit removes the writer. The flusher sets the sealed bit
+/// and waits for the writer count to drop to zero. A reservation that does
+/// not fit, or that lands in a sealed buffer, takes back its size and writer
+/// with one atomic subtract, so once no writer is left the reserved bytes are
+/// exactly the committed elements.
+#ifndef __TNY_OSC_ASSEMBLER__
+#define __TNY_OSC_ASSEMBLER__
+
+#include "tnyosc.hpp"
+
+#include <vector>
+
+namespace tnyosc {
+
+class BundleAssembler {
+ public:
+  /// Creates an assembler whose bundles hold at most capacity bytes,
+  /// including the 16-byte bundle header. Capacity is limited to 16 MB.
+  explicit BundleAssembler(size_t capacity=1472);
+
+  /// Reserves an element of size bytes (a multiple of 4) in the current
+  /// bundle and returns where to write it, or NULL if the bundle is full.
+  /// The element is sent only after commit is called with the returned
+  /// pointer. Safe to call from any number of threads.
+  char* reserve(size_t size);
+
+  /// Marks an element returned by reserve as written.
+  void commit(char* element);
+
+  /// Copies an encoded message or bundle into the current bundle.
+  ///
+  /// @return false if the bundle is full.
+  bool append(const char* data, size_t size) {
+    char* p = reserve(size);
+    if (p == NULL) return false;
+    memcpy(p, data, size);
+    commit(p);
+    return true;
+  }
+  bool append(const Message& message) {
+    return append(message.data(), message.size()); }
+
+  /// Seals the current bundle with timetag and starts a new one. Waits for
+  /// producers that are still writing into the sealed bundle. Must be called
+  /// from one thread at a time.
+  ///
+  /// @param[out] size The size of the sealed bundle.
+  /// @return the sealed bundle, valid until the next call to flush, or NULL
+  /// if no element was added.
+  const char* flush(uint64_t timetag, size_t* size);
+
+ private:
+  BundleAssembler(const BundleAssembler&);
+  BundleAssembler& operator=(const BundleAssembler&);
+
+  struct Buffer {
+    uint64_t state; // changed with atomic builtins only
+    std::vector<char> data; // bundle header followed by elements
+  };
+
+  Buffer buffers_[2];
+  Buffer* current_; // read and written with atomic builtins
+  size_t capacity_; // bytes available for elements
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_ASSEMBLER__
@@ -0,0 +1,90 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-audit.hpp
+/// @brief tnyosc realtime-safety audit
+/// @author Toshiro Yamada
+///
+/// When tnyosc is built with TNYOSC_RT_AUDIT=1 and linked with
+/// tnyosc-audit.cc, malloc, calloc, realloc, free and pthread_mutex_lock are
+/// interposed (glibc only) and every call made while a tnyosc API is running
+/// is counted against that API. Optionally the process aborts on the first
+/// such call, which pinpoints allocations on an audio thread in a debugger.
+///
+/// Without TNYOSC_RT_AUDIT, TNYOSC_AUDIT_SCOPE expands to nothing and none of
+/// this code is compiled.
+#ifndef __TNY_OSC_AUDIT__
+#define __TNY_OSC_AUDIT__
+
+#if TNYOSC_RT_AUDIT
+
+#include <cstddef>
+#include <inttypes.h>
+
+namespace tnyosc {
+
+// counters of one audited API
+struct AuditCounts {
+  const char* scope; // API name given to TNYOSC_AUDIT_SCOPE
+  uint64_t calls; // outermost entries into the API
+  uint64_t allocations; // malloc, calloc and realloc calls
+  uint64_t frees; // free calls
+  uint64_t locks; // pthread_mutex_lock calls
+};
+
+/// Marks the calling thread as inside an API until destroyed. Nested scopes
+/// are attributed to the outermost one. Use TNYOSC_AUDIT_SCOPE instead.
+class AuditScope {
+ public:
+  explicit AuditScope(const char* scope);
+  ~AuditScope();
+};
+
+/// If true, the process prints the API name and aborts on the first
+/// allocation, free or lock inside an audited API.
+void audit_set_abort(bool abort_on_violation);
+
+/// Copies the counters of up to max APIs into counts and returns how many
+/// APIs have been entered so far.
+size_t audit_report(AuditCounts* counts, size_t max);
+
+/// Returns the counters of one API, with all counts 0 if it was not entered.
+AuditCounts audit_counts(const char* scope);
+
+/// Resets all counters to zero.
+void audit_reset();
+
+} // namespace tnyosc
+
+#define TNYOSC_AUDIT_SCOPE(name) tnyosc::AuditScope tnyosc_audit_scope_(name)
+
+#else
+
+#define TNYOSC_AUDIT_SCOPE(name)
+
+#endif // TNYOSC_RT_AUDIT
+
+#endif // __TNY_OSC_AUDIT__
@@ -0,0 +1,124 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-block.hpp
+/// @brief tnyosc sample-accurate block dispatch
+/// @author Toshiro Yamada
+///
+/// BlockScheduler hands timetagged callbacks to an audio callback together
+/// with the sample offset at which each one falls inside the current block.
+/// A non-realtime thread posts callbacks returned by
+/// Dispatcher::match_methods; they travel through a single-producer,
+/// single-consumer ring to the audio thread, which keeps future events in a
+/// preallocated heap ordered by time. Callbacks that have been processed go
+/// back through a second ring and are released by the non-realtime thread,
+/// so process never allocates, frees or locks.
+#ifndef __TNY_OSC_BLOCK__
+#define __TNY_OSC_BLOCK__
+
+#include "tnyosc-dispatch.hpp"
+
+#include <vector>
+
+namespace tnyosc {
+
+// an event due inside a block
+struct BlockEvent {
+  uint32_t offset; // frame within the block; late events are at 0
+  const Callback* callback;
+};
+
+class BlockScheduler {
+ public:
+  /// Creates a scheduler holding up to capacity outstanding callbacks, of
+  /// which up to max_block_events are returned by one call to process.
+  explicit BlockScheduler(size_t capacity=1024, size_t max_block_events=256);
+  /// Releases all callbacks. No thread may be using the scheduler.
+  ~BlockScheduler();
+
+  /// Queues a callback for the audio thread. Callbacks without a timetag are
+  /// due in the next block. Also releases callbacks retired by process. Call
+  /// from one non-realtime thread only.
+  ///
+  /// @return false if capacity callbacks are already outstanding.
+  bool post(const CallbackRef& callback);
+
+  /// Releases callbacks retired by process. post does this as well.
+  void collect();
+
+  /// Returns the events due before the end of the block that starts at NTP
+  /// time block_start and lasts frames samples at sample_rate, in time
+  /// order, with their sample offsets. At most max (and at most
+  /// max_block_events) events are returned; the rest stay queued for the
+  /// next block. The callbacks stay valid until the next call to process.
+  /// Call from the audio thread only.
+  size_t process(uint64_t block_start, double sample_rate, uint32_t frames,
+      BlockEvent* out, size_t max);
+
+ private:
+  BlockScheduler(const BlockScheduler&);
+  BlockScheduler& operator=(const BlockScheduler&);
+
+  // fixed-size ring of callback pointers with one writer and one reader
+  struct Ring {
+    std::vector<CallbackRef*> slots;
+    size_t head; // next slot to read, written by the reader
+    size_t tail; // next slot to write, written by the writer
+
+    bool push(CallbackRef* callback);
+    CallbackRef* pop();
+  };
+
+  struct Event {
+    uint64_t time; // NTP time
+    uint64_t seq; // keeps post order among equal times
+    CallbackRef* callback;
+  };
+
+  struct LaterEvent {
+    bool operator()(const Event& a, const Event& b) const {
+      if (a.time != b.time) return a.time > b.time;
+      return a.seq > b.seq;
+    }
+  };
+
+  size_t capacity_;
+  size_t outstanding_; // posted and not yet released, owned by post
+  Ring incoming_; // post to process
+  Ring retired_; // process to collect
+  CallbackRef* pending_; // popped from incoming_ while the heap was full
+
+  // audio thread state, preallocated
+  std::vector<Event> heap_;
+  size_t heap_size_;
+  uint64_t seq_;
+  std::vector<CallbackRef*> in_use_; // returned by the last process
+  size_t num_in_use_;
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_BLOCK__
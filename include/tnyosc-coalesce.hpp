@@ -0,0 +1,131 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-coalesce.hpp
+/// @brief tnyosc coalescing output stage
+/// @author Toshiro Yamada
+///
+/// Coalescer sits in front of a sender and keeps only the latest message per
+/// OSC address (or per address and type tags) during a time window. When the
+/// window has passed, all pending messages are flushed into a single Bundle.
+/// Like tnyosc.hpp, this header does not send anything by itself.
+#ifndef __TNY_OSC_COALESCE__
+#define __TNY_OSC_COALESCE__
+
+#include "tnyosc.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace tnyosc {
+
+class Coalescer {
+ public:
+  /// Creates a coalescer that holds updates for window_usec microseconds
+  /// after the first pending update. If match_types is true, messages with
+  /// the same address but different type tags are kept separately.
+  explicit Coalescer(uint32_t window_usec, bool match_types=false)
+    : window_(((uint64_t)window_usec << 32) / 1000000UL),
+      match_types_(match_types), first_time_(0),
+      received_(0), coalesced_(0), flushed_(0), bundles_(0) {}
+  ~Coalescer() {}
+
+  /// Queues a message. If a message with the same key is already pending, it
+  /// is replaced in place so the flush order follows the first update.
+  ///
+  /// @param[in] message The OSC message to send.
+  /// @param[in] now Current NTP time, used to start the window.
+  /// @return true if a pending message was replaced.
+  bool append(const Message& message, uint64_t now=get_current_ntp_time()) {
+    ++received_;
+    std::string key(message.address());
+    if (match_types_) {
+      key.push_back('\0');
+      key.append(message.types().begin(), message.types().end());
+    }
+    std::map<std::string, size_t>::iterator it = index_.find(key);
+    if (it != index_.end()) {
+      pending_[it->second] = message;
+      ++coalesced_;
+      return true;
+    }
+    if (pending_.empty()) first_time_ = now;
+    index_.insert(std::make_pair(key, pending_.size()));
+    pending_.push_back(message);
+    return false; }
+
+  /// Returns true if there are pending messages and the window has passed.
+  ///
+  /// @param[in] now Current NTP time.
+  bool ready(uint64_t now=get_current_ntp_time()) const {
+    return !pending_.empty() && now - first_time_ >= window_; }
+
+  /// Appends all pending messages to bundle and starts a new window. Call this
+  /// once ready returns true, or at any time to force the pending updates out.
+  ///
+  /// @param[out] bundle The bundle to append pending messages to.
+  /// @return Number of messages appended.
+  size_t flush(Bundle& bundle) {
+    size_t count = pending_.size();
+    if (count == 0) return 0;
+    for (size_t i = 0; i < count; ++i) bundle.append(pending_[i]);
+    pending_.clear();
+    index_.clear();
+    flushed_ += count;
+    ++bundles_;
+    return count; }
+
+  /// Returns the number of messages waiting to be flushed.
+  size_t pending() const { return pending_.size(); }
+
+  // @{
+  /// @name Counters
+  /// Messages passed to append.
+  uint64_t received() const { return received_; }
+  /// Messages that replaced a pending message and were never sent.
+  uint64_t coalesced() const { return coalesced_; }
+  /// Messages appended to bundles by flush.
+  uint64_t flushed() const { return flushed_; }
+  /// Bundles filled by flush.
+  uint64_t bundles() const { return bundles_; }
+  // @}
+
+ private:
+  uint64_t window_; // in NTP units (1/2^32 second)
+  bool match_types_;
+  uint64_t first_time_; // NTP time of the first pending update
+  std::vector<Message> pending_;
+  std::map<std::string, size_t> index_; // key to index in pending_
+  uint64_t received_;
+  uint64_t coalesced_;
+  uint64_t flushed_;
+  uint64_t bundles_;
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_COALESCE__
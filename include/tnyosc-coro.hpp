@@ -0,0 +1,260 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-coro.hpp
+/// @brief tnyosc C++20 coroutine interface
+/// @author Toshiro Yamada
+///
+/// Lets a coroutine wait for an OSC message instead of registering a
+/// callback:
+///
+/// <pre>
+///   tnyosc::Task run_cue(tnyosc::EventLoop& osc) {
+///     tnyosc::Received done = co_await osc.next("/cue/1/done", 5000);
+///     if (done.timed_out) { ... }
+///   }
+/// </pre>
+///
+/// EventLoop drives a single UDP socket on the calling thread: it waits for
+/// the socket or the nearest timeout, decodes packets, and resumes the
+/// coroutines waiting for a matching address. Waiting costs no thread and no
+/// allocation beyond the coroutine frame, since the waiter record lives in the
+/// frame itself. Unlike the rest of tnyosc, this header requires C++20 and is
+/// header-only.
+#ifndef __TNY_OSC_CORO__
+#define __TNY_OSC_CORO__
+
+#if __cplusplus >= 202002L
+
+#include "tnyosc-dispatch.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+namespace tnyosc {
+
+/// Coroutine return type for tasks driven by an EventLoop. A Task starts
+/// running immediately and frees its frame when it finishes; it cannot be
+/// awaited or cancelled.
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return Task(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+/// Result of waiting for a message.
+struct Received {
+  bool timed_out; // true if no message arrived before the timeout
+  struct timeval timetag;
+  std::string address;
+  std::vector<Argument> argv;
+  PacketBuffer buffer; // packet argv points into
+};
+
+class EventLoop {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  /// Awaiter returned by next. It is kept in the awaiting coroutine's frame
+  /// and linked into the loop's waiter list while suspended.
+  class Next {
+   public:
+    Next(EventLoop& loop, const std::string& pattern, int timeout_ms)
+      : loop_(loop), pattern_(pattern), has_deadline_(timeout_ms >= 0),
+        prev_(nullptr), next_(nullptr) {
+      if (has_deadline_) {
+        deadline_ = Clock::now() + std::chrono::milliseconds(timeout_ms);
+      }
+      result_.timed_out = false;
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      handle_ = handle;
+      loop_.link(this);
+    }
+    Received await_resume() { return std::move(result_); }
+
+   private:
+    friend class EventLoop;
+    EventLoop& loop_;
+    std::string pattern_;
+    bool has_deadline_;
+    Clock::time_point deadline_;
+    std::coroutine_handle<> handle_;
+    Received result_;
+    Next* prev_;
+    Next* next_;
+  };
+
+  /// Creates a loop reading OSC packets from fd, a bound UDP socket that the
+  /// caller keeps open. If dispatcher is given, every packet is also matched
+  /// against its methods, which are invoked before waiters are resumed.
+  explicit EventLoop(int fd, Dispatcher* dispatcher=nullptr)
+    : fd_(fd), dispatcher_(dispatcher), head_(nullptr), num_waiters_(0),
+      stopped_(false), buffer_(65536) {}
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  /// Returns an awaitable that resumes with the next message whose address
+  /// matches pattern (see Dispatcher::pattern_match), or with timed_out set
+  /// after timeout_ms milliseconds. A negative timeout waits forever. Every
+  /// waiter matching a message receives its own copy.
+  Next next(const std::string& pattern, int timeout_ms=-1) {
+    return Next(*this, pattern, timeout_ms);
+  }
+
+  /// Waits up to max_wait_ms (or until the nearest waiter timeout) for a
+  /// packet, handles it, and resumes the coroutines that became ready.
+  /// Returns false if the socket reported an error.
+  bool run_once(int max_wait_ms=-1) {
+    int wait_ms = max_wait_ms;
+    Clock::time_point now = Clock::now();
+    for (Next* w = head_; w != nullptr; w = w->next_) {
+      if (!w->has_deadline_) continue;
+      long long ms = std::chrono::ceil<std::chrono::milliseconds>(
+          w->deadline_ - now).count();
+      if (ms < 0) ms = 0;
+      if (wait_ms < 0 || ms < wait_ms) wait_ms = (int)ms;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    int ready = poll(&pfd, 1, wait_ms);
+    if (ready < 0) return false;
+
+    std::vector<Next*> resumed;
+    if (ready > 0) {
+      ssize_t size = recv(fd_, &buffer_[0], buffer_.size(), 0);
+      if (size > 0) deliver(&buffer_[0], size, resumed);
+    }
+    expire(Clock::now(), resumed);
+    for (size_t i = 0; i < resumed.size(); ++i) {
+      resumed[i]->handle_.resume();
+    }
+    return true;
+  }
+
+  /// Runs until stop is called, typically from inside a coroutine.
+  void run() {
+    stopped_ = false;
+    while (!stopped_ && run_once()) {}
+  }
+
+  /// Makes run return after the current iteration.
+  void stop() { stopped_ = true; }
+
+  /// Returns the number of suspended coroutines waiting for a message.
+  size_t num_waiters() const { return num_waiters_; }
+
+ private:
+  void link(Next* w) {
+    w->prev_ = nullptr;
+    w->next_ = head_;
+    if (head_ != nullptr) head_->prev_ = w;
+    head_ = w;
+    ++num_waiters_;
+  }
+
+  void unlink(Next* w) {
+    if (w->prev_ != nullptr) w->prev_->next_ = w->next_;
+    else head_ = w->next_;
+    if (w->next_ != nullptr) w->next_->prev_ = w->prev_;
+    w->prev_ = w->next_ = nullptr;
+    --num_waiters_;
+  }
+
+  void deliver(const char* data, size_t size, std::vector<Next*>& resumed) {
+    if (dispatcher_ != nullptr) {
+      std::list<CallbackRef> callbacks = dispatcher_->match_methods(data, size);
+      for (std::list<CallbackRef>::iterator it = callbacks.begin();
+          it != callbacks.end(); ++it) {
+        dispatcher_->invoke(*it);
+      }
+    }
+    if (head_ == nullptr) return;
+
+    // awaiting coroutines keep the arguments after data is reused
+    PacketBuffer buffer(new std::vector<char>(data, data + size));
+    if (size == 0) return;
+    std::list<ParsedMessage> messages;
+    if (!Dispatcher::decode_data(&(*buffer)[0], size, messages)) return;
+    for (std::list<ParsedMessage>::iterator m = messages.begin();
+        m != messages.end(); ++m) {
+      Next* w = head_;
+      while (w != nullptr) {
+        Next* next = w->next_;
+        if (Dispatcher::pattern_match(m->address, w->pattern_)) {
+          unlink(w);
+          w->result_.timetag = m->timetag;
+          w->result_.address = m->address;
+          w->result_.argv = m->argv;
+          w->result_.buffer = buffer;
+          resumed.push_back(w);
+        }
+        w = next;
+      }
+    }
+  }
+
+  void expire(Clock::time_point now, std::vector<Next*>& resumed) {
+    Next* w = head_;
+    while (w != nullptr) {
+      Next* next = w->next_;
+      if (w->has_deadline_ && w->deadline_ <= now) {
+        unlink(w);
+        w->result_.timed_out = true;
+        resumed.push_back(w);
+      }
+      w = next;
+    }
+  }
+
+  int fd_;
+  Dispatcher* dispatcher_;
+  Next* head_; // intrusive list of suspended waiters
+  size_t num_waiters_;
+  bool stopped_;
+  std::vector<char> buffer_;
+};
+
+} // namespace tnyosc
+
+#endif // __cplusplus >= 202002L
+
+#endif // __TNY_OSC_CORO__
@@ -30,27 +30,37 @@
 #ifndef __TNY_OSC_DISPATCH__
 #define __TNY_OSC_DISPATCH__
 
+#include "tnyosc-index.hpp"
+
 #include <string>
 #include <vector>
 #include <list>
 #include <tr1/memory>
+#include <tr1/unordered_map>
 
 #include <time.h>
 
 namespace tnyosc {
 
+// Raw packet that decoded arguments point into, shared by the messages and
+// callbacks decoded from it.
+typedef std::tr1::shared_ptr<std::vector<char> > PacketBuffer;
+
+// A decoded argument is a 16-byte, trivially copyable record. Strings, blobs
+// and arrays are not copied out of the packet: s, S and b point into it, so
+// they are only valid while the packet is (see ParsedMessage::buffer).
 struct Argument {
   char type;    // OSC type tag
-  size_t size;  // size in byte
+  uint32_t size;  // size in byte
   union {
     int32_t i;  // int32
     float f;    // float32
-    char* s;    // OSC-string 
-    void* b;    // OSC-blob
+    const char* s;    // OSC-string, null-terminated
+    const void* b;    // OSC-blob
     int64_t h;  // int64
     double d;   // float64
     uint64_t t; // OSC-timetag
-    char* S;    // Alternate OSC-string, such as "symbols"
+    const char* S;    // Alternate OSC-string, such as "symbols"
     char c;     // ASCII character
     uint32_t r; // 32-bit RGBA color
     struct {
@@ -62,9 +72,82 @@ struct Argument {
   } data;
 
   Argument();
-  Argument(const Argument& a) ;
-  virtual ~Argument();
-  Argument& operator=(const Argument& a);
+};
+
+// Read-only view of an OSC array argument ('[' ... ']') whose elements all
+// have the same fixed-size numeric type. The '[' argument points at the array
+// data in network byte order, so the values can be converted into a caller's
+// buffer in one pass instead of reading each element's Argument.
+struct ArrayView {
+  char type;         // element type tag: 'i', 'f', 'h', 'd' or 0 if invalid
+  size_t count;      // number of elements
+  const char* data;  // element data in network byte order
+
+  ArrayView();
+
+  /// Makes a view of the array that starts at argv[index]. Returns false if
+  /// argv[index] is not '[' or its elements are not of a single numeric type.
+  bool assign(const std::vector<Argument>& argv, size_t index);
+
+  /// Converts up to max elements into out and returns how many were copied.
+  /// Returns 0 if the element type does not match the buffer type.
+  size_t copy_to(int32_t* out, size_t max) const;
+  size_t copy_to(float* out, size_t max) const;
+  size_t copy_to(int64_t* out, size_t max) const;
+  size_t copy_to(double* out, size_t max) const;
+};
+
+/// MessageReader reads arguments straight out of a raw OSC message without
+/// creating ParsedMessage or Argument objects and without allocating. Runs of
+/// the same numeric type tag (e.g. ",ffff...f") are converted into a
+/// caller's array in one pass, which is much cheaper than decode_data for
+/// messages carrying hundreds of values. The reader points into the raw data,
+/// which must outlive it.
+class MessageReader {
+ public:
+  MessageReader();
+
+  /// Reads the address and type tags of a raw OSC message. Bundles are not
+  /// accepted; use the elements of a bundle instead.
+  ///
+  /// @return false if the message is malformed.
+  bool parse(const char* data, size_t size);
+
+  /// Returns the OSC-Address of the message.
+  const char* address() const { return address_; }
+  /// Returns the OSC-type tags of the message without the leading ','.
+  const char* types() const { return types_; }
+  /// Returns the number of type tags, including array brackets.
+  size_t num_args() const { return num_args_; }
+
+  /// Returns how many consecutive arguments starting at index have the same
+  /// type tag as the argument at index.
+  size_t run_length(size_t index) const;
+
+  /// Converts up to max arguments starting at index into out. The arguments
+  /// must be a run of 'i', 'f', 'h' or 'd' respectively; reading stops at the
+  /// end of the run.
+  ///
+  /// @return Number of values copied, or 0 if the type at index does not
+  /// match or the message is truncated.
+  size_t read_int32s(size_t index, int32_t* out, size_t max);
+  size_t read_floats(size_t index, float* out, size_t max);
+  size_t read_int64s(size_t index, int64_t* out, size_t max);
+  size_t read_doubles(size_t index, double* out, size_t max);
+
+ private:
+  size_t read_run(size_t index, char type, size_t width, void* out,
+      size_t max);
+  bool seek(size_t index);
+
+  const char* end_;
+  const char* address_;
+  const char* types_;
+  const char* args_; // first argument
+  size_t num_args_;
+  // position of argument cursor_index_, so sequential reads do not rescan
+  size_t cursor_index_;
+  const char* cursor_;
 };
 
 typedef void (*osc_method)(const std::string& address, 
@@ -78,11 +161,20 @@ struct MethodTemplate {
   osc_method method; // OSC-Methods to call
 };
 
+// OSC method and user data bound to a method slot of a Dispatcher
+struct MethodBinding {
+  osc_method method;
+  void* user_data;
+};
+
 struct ParsedMessage {
   struct timeval timetag; 
   std::string address;
   std::string types;
   std::vector<Argument> argv;
+  // packet argv points into; left empty by decode_data, which borrows the
+  // caller's data
+  PacketBuffer buffer;
 };
 
 // structure to hold callback function for a given OSC packet
@@ -92,11 +184,224 @@ struct Callback {
   std::vector<Argument> argv;
   void* user_data; // user data
   osc_method method; // matched method to call
+  PacketBuffer buffer; // packet argv points into
 };
 
 typedef std::tr1::shared_ptr<Callback> CallbackRef;
 // use to sort list<Callback> according to their timetag
 
+/// Converts a decoded timetag back to NTP time; the inverse of
+/// ntp_to_unixtime in tnyosc-dispatch.cc. The immediate timetag {0, 0} maps
+/// back to 1.
+inline uint64_t unixtime_to_ntp(const struct timeval& tv)
+{
+  // time between 1-1-1900 and 1-1-1970
+  static const uint64_t epoch = 2208988800UL;
+  if (tv.tv_sec == 0 && tv.tv_usec == 0) return 1;
+  uint64_t sec = tv.tv_sec + epoch;
+  uint64_t frac = ((uint64_t)tv.tv_usec << 32) / 1000000UL;
+  return (sec << 32) | frac;
+}
+
+// reasons for decode_data to reject a packet
+enum DecodeError {
+  kDecodeOk = 0,
+  kDecodeBadBundle,    // bundle header or element size is out of bounds
+  kDecodeBadAddress,   // OSC-Address is not null-terminated
+  kDecodeBadTypes,     // OSC-type tag string is missing or not terminated
+  kDecodeBadArgument,  // argument data runs past the end of the packet
+  kNumDecodeErrors
+};
+
+#if TNYOSC_STATS
+/// Latency histogram in nanoseconds with HDR-style log-linear buckets: each
+/// power of two is split into kSubBuckets linear buckets, so any recorded
+/// value is reported within 1/kSubBuckets of its true value.
+struct LatencyHistogram {
+  static const int kSubBits = 3;
+  static const int kSubBuckets = 1 << kSubBits;
+  static const int kMaxBits = 40; // values >= 2^40 ns (~18 min) are clamped
+  static const int kNumBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[kNumBuckets];
+
+  LatencyHistogram();
+  void record(uint64_t ns);
+  void merge(const LatencyHistogram& other);
+  /// Returns the lower bound of the bucket holding the p-th percentile
+  /// (0.0 < p <= 100.0), or 0 if nothing was recorded.
+  uint64_t percentile(double p) const;
+};
+
+// per-method counters copied out of the method templates by a snapshot
+struct MethodStats {
+  std::string address;
+  uint64_t match_attempts;
+  uint64_t match_hits;
+};
+
+/// Snapshot of the counters kept by a Dispatcher built with TNYOSC_STATS.
+/// A Dispatcher is not shared between threads, so counters are plain integers
+/// owned by it; run one Dispatcher per thread and merge their snapshots.
+struct DispatchStats {
+  uint64_t packets; // packets passed to match_methods
+  uint64_t messages; // messages decoded from those packets
+  uint64_t callbacks; // callbacks returned by match_methods
+  uint64_t decode_errors[kNumDecodeErrors]; // rejected packets by reason
+  LatencyHistogram decode_latency; // decode_data per packet
+  LatencyHistogram match_latency; // method matching per packet
+  LatencyHistogram handler_latency; // per call to Dispatcher::invoke
+  std::vector<MethodStats> methods; // in registration order
+
+  DispatchStats();
+  void merge(const DispatchStats& other);
+};
+#endif // TNYOSC_STATS
+
+// location of a message inside a raw packet, as listed by index_packet
+struct PacketElement {
+  const char* data;
+  size_t size;
+  struct timeval timetag; // inherited from the innermost enclosing bundle
+};
+
+struct MatchCacheStats {
+  uint64_t hits; // lookups answered from the cache
+  uint64_t misses; // lookups that had to match against every method
+  uint64_t evictions; // entries replaced to stay within capacity
+
+  MatchCacheStats() : hits(0), misses(0), evictions(0) {}
+};
+
+/// Bounded cache from an incoming OSC-Address to the indices of the methods
+/// whose address pattern matches it. Entries are replaced with the CLOCK
+/// algorithm once capacity is reached. Every lookup passes the dispatcher's
+/// generation counter; when it changes, all entries are dropped.
+class MatchCache {
+ public:
+  explicit MatchCache(size_t capacity);
+
+  /// Returns the cached method indices for address, or NULL on a miss.
+  const std::vector<uint32_t>* find(const std::string& address,
+      uint64_t generation);
+
+  /// Stores the method indices for address and returns a pointer to the
+  /// stored copy, valid until the next call to insert.
+  const std::vector<uint32_t>* insert(const std::string& address,
+      uint64_t generation, const std::vector<uint32_t>& methods);
+
+  /// Sets the maximum number of entries. 0 disables caching.
+  void set_capacity(size_t capacity);
+  void clear();
+
+  const MatchCacheStats& stats() const { return stats_; }
+
+ private:
+  struct Entry {
+    std::string address;
+    std::vector<uint32_t> methods;
+    bool referenced; // set on a hit, cleared as the CLOCK hand passes
+  };
+  typedef std::tr1::unordered_map<std::string, size_t> Index;
+
+  size_t capacity_;
+  std::vector<Entry> entries_;
+  Index index_; // address to position in entries_
+  size_t hand_;
+  uint64_t generation_;
+  std::vector<uint32_t> scratch_; // returned by insert when not caching
+  MatchCacheStats stats_;
+};
+
+/// Decoding plan compiled from one OSC-type tag string. Arguments before the
+/// first variable-length one ('s', 'S', 'b' or '[') sit at fixed offsets from
+/// the start of the argument data, so they are bounds-checked once against
+/// fixed_size and decoded straight from their slots.
+struct SignatureLayout {
+  // converts one fixed-size argument from network byte order
+  typedef void (*decode_function)(const char* data, Argument& argument);
+
+  struct Slot {
+    uint32_t offset; // from the start of the argument data
+    decode_function decode;
+  };
+
+  std::vector<Slot> slots; // one per argument of the fixed-size prefix
+  size_t fixed_size; // bytes used by the fixed-size prefix
+};
+
+/// Maps OSC-type tag strings to their SignatureLayout, compiling a layout the
+/// first time a type tag string is seen. Traffic usually has a few dozen
+/// signatures, so the cache is simply emptied when it reaches capacity.
+class SignatureCache {
+ public:
+  explicit SignatureCache(size_t capacity=256);
+
+  /// Returns the layout for the size bytes of types (without the leading
+  /// ','), valid until the next call to find. A hit hashes and compares the
+  /// raw bytes and does not allocate.
+  const SignatureLayout& find(const char* types, size_t size);
+
+  const SignatureLayout& find(const std::string& types) {
+    return find(types.data(), types.size()); }
+
+  size_t size() const { return size_; }
+  void clear();
+
+ private:
+  // slot of the open-addressed table; cleared slots keep their storage
+  struct Entry {
+    bool used;
+    uint32_t hash;
+    std::string types;
+    SignatureLayout layout;
+  };
+
+  size_t capacity_;
+  size_t size_;
+  std::vector<Entry> entries_; // power of two, at least twice capacity_
+};
+
+// a raw packet passed to Dispatcher::match_batch
+struct PacketRef {
+  const char* data;
+  size_t size;
+};
+
+// a message and one of its matching methods, found by match_batch
+struct BatchMatch {
+  uint64_t timetag; // sort key: seconds * 1000000 + microseconds
+  uint32_t message; // index into MatchBatch::messages
+  uint32_t method; // method index in registration order
+};
+
+/// Output of Dispatcher::match_batch. Reuse one MatchBatch across calls: the
+/// decoded messages are kept as slots whose strings and argument vectors keep
+/// their capacity, so steady-state batches allocate little. Arguments point
+/// into the packets passed to match_batch, which must outlive the results.
+struct MatchBatch {
+  std::vector<ParsedMessage> messages; // first num_messages are valid
+  size_t num_messages;
+  std::vector<BatchMatch> matches; // sorted by timetag, stable
+  size_t malformed; // packets that failed to decode and were skipped
+
+  MatchBatch() : num_messages(0), malformed(0) {}
+
+ private:
+  friend class Dispatcher;
+  std::vector<PacketElement> elements_; // messages of the current packet
+  std::vector<BatchMatch> scratch_; // radix sort buffer
+  // unique addresses of the batch and their matched method indices
+  std::tr1::unordered_map<std::string, uint32_t> groups_;
+  std::vector<std::vector<uint32_t> > group_methods_;
+};
+
+class Bundle;
+class WorkerPool;
+
 class Dispatcher {
  public:
   Dispatcher();
@@ -108,23 +413,131 @@ class Dispatcher {
   void add_method(const char* address, const char* types, 
       osc_method method, void* user_data);
 
+  /// Number of methods added with add_method or load_snapshot.
+  size_t num_methods() const { return bindings_.size(); }
+
+  /// Writes the methods added so far, with their addresses, type tags and
+  /// address index, to a snapshot file. Method slot i is the i-th method
+  /// added; the OSC methods and user data are not saved.
+  bool save_snapshot(const char* path) const;
+
+  /// Replaces all methods with those in a snapshot written by
+  /// save_snapshot, and binds methods[i] and user_data[i] (NULL for none) to
+  /// slot i. The file is mapped and used in place without parsing, so this
+  /// takes about the same time however many methods it holds. Returns false
+  /// if the file cannot be mapped or does not hold num_methods methods.
+  bool load_snapshot(const char* path, const osc_method* methods,
+      void* const* user_data, size_t num_methods);
+
+  /// Number of incoming addresses whose matched methods are remembered by
+  /// match_methods, so repeated addresses skip pattern matching.
+  static const size_t kDefaultCacheCapacity = 1024;
+
+  /// Sets how many addresses the match cache holds. 0 disables the cache.
+  void set_cache_capacity(size_t capacity);
+
+  /// Returns hit and miss counts of the match cache.
+  const MatchCacheStats& cache_stats() const { return cache_.stats(); }
+
   /// Deserializes a raw Open Sound Control message (as coming from a network)
   /// and returns a list of CallbackRef that matches with the registered method
   /// tempaltes.
   std::list<CallbackRef> match_methods(const char* data, size_t size);
 
+  /// Same as match_methods, but decodes and matches the messages of a large
+  /// bundle on the threads of pool. The packet is first indexed with
+  /// index_packet, then split into contiguous ranges of messages that are
+  /// processed in parallel and merged back in bundle order before sorting by
+  /// timetag. add_method must not be called while this is running. The match
+  /// cache is not shared with the worker threads and is not used.
+  std::list<CallbackRef> match_methods_parallel(const char* data, size_t size,
+      WorkerPool& pool);
+
+  /// Decodes and matches n packets at once into out. Each distinct address
+  /// in the batch is matched against the methods only once, and the results
+  /// are a flat array of (message, method) pairs sorted by timetag instead
+  /// of a list of callbacks. Malformed packets are skipped and counted.
+  void match_batch(const PacketRef* packets, size_t n, MatchBatch& out);
+
+  /// Invokes the OSC method of a callback returned by match_methods. This is
+  /// the same as calling callback->method directly, except that the handler
+  /// latency is recorded when built with TNYOSC_STATS.
+  void invoke(const CallbackRef& callback);
+
+  /// Invokes the method of a match found by match_batch.
+  void invoke(const MatchBatch& batch, const BatchMatch& match);
+
   /// decode_data is called inside match_methods to extract the OSC data from
-  /// a raw data.
+  /// a raw data. Strings, blobs and arrays in the decoded arguments point
+  /// into data, which must outlive messages. If error is given, it is set to
+  /// the reason of a failure. If signatures is given, the fixed-size
+  /// arguments of each message are decoded with the cached layout of its type
+  /// tag string; match_methods uses a cache owned by the dispatcher.
   static bool decode_data(const char* data, size_t size, 
-      std::list<ParsedMessage>& messages, struct timeval timetag=kZeroTimetag);
+      std::list<ParsedMessage>& messages, struct timeval timetag=kZeroTimetag,
+      DecodeError* error=NULL, SignatureCache* signatures=NULL);
+
+  /// Lists the messages in a raw packet, descending into nested bundles,
+  /// without decoding them. Bundle headers and element sizes are checked, so
+  /// every element lies within data.
+  static bool index_packet(const char* data, size_t size,
+      std::vector<PacketElement>& elements,
+      struct timeval timetag=kZeroTimetag, DecodeError* error=NULL);
+
+  /// Returns true if the OSC-Address lhs matches the address pattern rhs,
+  /// following the OSC pattern matching rules. Wildcards match within one
+  /// part of the address, and "//" matches any number of parts (OSC 1.1).
+  static bool pattern_match(const std::string& lhs, const std::string& rhs);
+
+#if TNYOSC_STATS
+  /// Returns a copy of the counters collected so far.
+  DispatchStats stats() const;
+
+  /// Resets all counters, including the per-method counters.
+  void reset_stats();
+
+  /// Appends the current counters to bundle as OSC messages under prefix
+  /// (e.g. "/tnyosc/stats/packets"), so they can be sent to a monitor.
+  void publish_stats(Bundle& bundle, const char* prefix="/tnyosc/stats") const;
+#endif // TNYOSC_STATS
 
  private:
   static const struct timeval kZeroTimetag;
   static bool decode_osc(const char* data, size_t size, 
-      std::list<ParsedMessage>& messages, struct timeval timetag);
-  static bool pattern_match(const std::string& lhs, const std::string& rhs);
+      std::list<ParsedMessage>& messages, struct timeval timetag,
+      DecodeError* error, SignatureCache* signatures);
+  static bool decode_message(const char* data, size_t size, ParsedMessage& m,
+      struct timeval timetag, DecodeError* error, SignatureCache* signatures);
+  static void match_range(void* arg, size_t index);
+
+  // The following only read index_ and bindings_, so they may run on
+  // several threads at once. counts holds match attempts and hits for each
+  // method when built with TNYOSC_STATS, and is NULL otherwise.
+
+  // Appends the indices of methods whose address matches address, in
+  // registration order.
+  void find_methods(const std::string& address,
+      std::vector<uint32_t>& indices, uint64_t* counts) const;
+  // Appends callbacks for the methods in indices whose types match message.
+  void add_callbacks(const ParsedMessage& message,
+      const std::vector<uint32_t>& indices, std::list<CallbackRef>& callbacks,
+      uint64_t* counts) const;
+  // find_methods followed by add_callbacks.
+  void match_message(const ParsedMessage& message,
+      std::list<CallbackRef>& callbacks, uint64_t* counts) const;
 
-  std::list<MethodTemplate> methods_;
+  MethodIndex index_; // addresses and types of the methods
+  std::vector<MethodBinding> bindings_; // by method slot
+  MatchCache cache_;
+  SignatureCache signatures_;
+  uint64_t generation_; // incremented by add_method
+#if TNYOSC_STATS
+  DispatchStats stats_; // methods is left empty and filled in by stats()
+  // per method, the lookup count when it was added and its hits, followed
+  // by the number of find_methods calls; every lookup is an attempt for
+  // each method registered at the time
+  std::vector<uint64_t> method_counts_;
+#endif // TNYOSC_STATS
 };
 
 } // namespace tnyosc
@@ -0,0 +1,220 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-fragment.hpp
+/// @brief tnyosc blob fragmentation and reassembly
+/// @author Toshiro Yamada
+///
+/// Fragmenter splits a large blob into OSC messages that each fit in one UDP
+/// datagram. Every fragment is sent to kFragmentAddress with the type tags
+/// ",siiib": the address the blob is meant for, a transfer ID, the byte
+/// offset of the fragment, the total blob size and the fragment data.
+///
+/// Reassembler registers itself with a Dispatcher for the fragment address.
+/// The first fragment of a transfer allocates a buffer of the total size, and
+/// every fragment, in any order, is copied straight to its offset. When all
+/// bytes have arrived the completion function is called with the target
+/// address and the whole blob. A transfer is identified by its source (given
+/// to attach), target address and ID together, so senders that happen to
+/// pick the same ID do not mix their fragments. Incomplete transfers are
+/// dropped after a timeout, and missing reports the gaps of a transfer so
+/// they can be requested again.
+#ifndef __TNY_OSC_FRAGMENT__
+#define __TNY_OSC_FRAGMENT__
+
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace tnyosc {
+
+// address of fragment messages
+const char* const kFragmentAddress = "/tnyosc/fragment";
+
+class Fragmenter {
+ public:
+  /// Creates a fragmenter whose messages are at most max_packet_size bytes.
+  /// Transfer IDs count up from first_id; by default it is random so that
+  /// senders started at the same time, or a restarted sender, do not reuse
+  /// each other's IDs.
+  explicit Fragmenter(size_t max_packet_size=1472, uint32_t first_id=0)
+    : max_packet_size_(max_packet_size),
+      next_id_(first_id ? first_id : random_id()) {}
+  ~Fragmenter() {}
+
+  /// Returns the number of blob bytes carried by each fragment for target,
+  /// or 0 if max_packet_size is too small for the fragment header.
+  size_t chunk_size(const char* target) const {
+    size_t header = padded(strlen(kFragmentAddress)) + padded(6) +
+      padded(strlen(target)) + 4 * 4;
+    if (max_packet_size_ <= header + 4) return 0;
+    return (max_packet_size_ - header) & ~(size_t)3; }
+
+  /// Appends the fragments of a blob for target to messages.
+  ///
+  /// @return the transfer ID, or 0 if the packet size is too small.
+  uint32_t split(const char* target, const void* data, size_t size,
+      std::vector<Message>& messages) {
+    size_t chunk = chunk_size(target);
+    if (chunk == 0 || size > 0x7fffffff) return 0;
+    uint32_t id = next_id_++;
+    if (id == 0) id = next_id_++;
+    size_t offset = 0;
+    do {
+      size_t n = size - offset < chunk ? size - offset : chunk;
+      Message msg(kFragmentAddress);
+      msg.append(std::string(target));
+      msg.append((int32_t)id);
+      msg.append((int32_t)offset);
+      msg.append((int32_t)size);
+      msg.append_blob((char*)data + offset, n);
+      messages.push_back(msg);
+      offset += n;
+    } while (offset < size);
+    return id; }
+
+ private:
+  // size of an OSC-string of length n, including its padding
+  static size_t padded(size_t n) { return n + 4 - n % 4; }
+
+  // reads /dev/urandom, falling back to the clock and process ID
+  static uint32_t random_id() {
+    uint32_t id = 0;
+    FILE* file = fopen("/dev/urandom", "rb");
+    if (file != NULL) {
+      if (fread(&id, sizeof(id), 1, file) != 1) id = 0;
+      fclose(file);
+    }
+    if (id == 0) id = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    return id; }
+
+  size_t max_packet_size_;
+  uint32_t next_id_;
+};
+
+/// Called by Reassembler with a completed blob. data is only valid during
+/// the call.
+typedef void (*transfer_function)(const std::string& address,
+    const char* data, size_t size, void* user_data);
+
+struct ReassemblyStats {
+  uint64_t fragments; // fragments accepted
+  uint64_t duplicates; // fragments whose bytes had all arrived before
+  uint64_t rejected; // malformed or inconsistent fragments
+  uint64_t completed; // transfers passed to the completion function
+  uint64_t timed_out; // incomplete transfers dropped by expire
+
+  ReassemblyStats() : fragments(0), duplicates(0), rejected(0), completed(0),
+    timed_out(0) {}
+};
+
+class Reassembler {
+ public:
+  /// Calls done for every completed transfer. Transfers larger than
+  /// max_transfer_size are rejected, and transfers that receive no fragment
+  /// for timeout_ms milliseconds are dropped.
+  Reassembler(transfer_function done, void* user_data,
+      size_t max_transfer_size=64 << 20, int timeout_ms=2000);
+
+  /// Adds a method to dispatcher that passes fragment messages to add with
+  /// source, e.g. the sender's "host:port" when each peer has its own
+  /// dispatcher. Transfers from different sources never mix.
+  void attach(Dispatcher& dispatcher, const char* address=kFragmentAddress,
+      const std::string& source=std::string());
+
+  /// Adds one fragment from source, given as the arguments of a fragment
+  /// message. Incomplete transfers that have timed out are dropped first.
+  ///
+  /// @return false if the fragment was rejected.
+  bool add(const std::vector<Argument>& argv,
+      const std::string& source=std::string());
+
+  /// Drops incomplete transfers that have timed out and returns how many.
+  size_t expire();
+
+  /// Lists the byte ranges [first, second) not yet received for transfer id
+  /// to address from source.
+  ///
+  /// @return false if the transfer is unknown or already completed.
+  bool missing(const std::string& address, uint32_t id,
+      std::vector<std::pair<size_t, size_t> >& ranges,
+      const std::string& source=std::string()) const;
+
+  /// Returns the number of incomplete transfers.
+  size_t pending() const { return transfers_.size(); }
+
+  const ReassemblyStats& stats() const { return stats_; }
+
+ private:
+  // identifies a transfer; the target address is part of the key, so a
+  // fragment for another address never lands in a transfer's buffer
+  struct TransferKey {
+    std::string source;
+    std::string address;
+    uint32_t id;
+
+    bool operator<(const TransferKey& other) const {
+      if (id != other.id) return id < other.id;
+      if (address != other.address) return address < other.address;
+      return source < other.source; }
+  };
+
+  // user data of a method added by attach
+  struct Source {
+    Reassembler* reassembler;
+    std::string key;
+  };
+
+  struct Transfer {
+    std::vector<char> data; // allocated once at the total size
+    std::map<size_t, size_t> ranges; // received [start, end), merged
+    size_t received; // bytes covered by ranges
+    uint64_t last_ns; // when the last fragment arrived
+  };
+
+  static void fragment_method(const std::string& address,
+      const std::vector<Argument>& argv, void* user_data);
+
+  transfer_function done_;
+  void* user_data_;
+  size_t max_transfer_size_;
+  uint64_t timeout_ns_;
+  std::map<TransferKey, Transfer> transfers_;
+  std::list<Source> sources_; // one per attach, never moved
+  ReassemblyStats stats_;
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_FRAGMENT__
@@ -0,0 +1,163 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-index.hpp
+/// @brief tnyosc prefix tree of method addresses
+/// @author Toshiro Yamada
+///
+/// MethodIndex organizes the addresses of the methods added to a Dispatcher
+/// by their '/'-separated parts, so an incoming address is matched by walking
+/// down the tree instead of against every method. Parts without wildcards are
+/// found through a hash table of edges; parts with wildcards, and the OSC 1.1
+/// "//" wildcard that matches any number of parts, are tried at each node.
+/// The walk is memoized so every node is visited at most once per position in
+/// the address, which keeps "//" patterns from backtracking exponentially.
+///
+/// The tree is stored in flat arrays linked by integer offsets rather than
+/// pointers, together with the address and type tag string of every method.
+/// save writes the arrays to a file as they are, and load maps such a file
+/// and uses it in place, so loading does not depend on the number of methods.
+#ifndef __TNY_OSC_INDEX__
+#define __TNY_OSC_INDEX__
+
+#include <string>
+#include <vector>
+#include <tr1/memory>
+
+#include <stdint.h>
+
+namespace tnyosc {
+
+class MethodIndex {
+ public:
+  /// Marks a missing node or method in the arrays below.
+  static const uint32_t kNone = 0xffffffff;
+
+  enum NodeFlags {
+    kPattern = 1, // the part has wildcards and is listed under patterns
+    kTraverse = 2 // the part is the "//" wildcard
+  };
+
+  struct Node {
+    uint32_t name; // offset of the part in the string pool
+    uint32_t name_size;
+    uint32_t parent; // kNone for the root
+    uint32_t patterns; // first child with kPattern set
+    uint32_t next; // next child with kPattern set of the same parent
+    uint32_t methods; // last method added at this node
+    uint32_t flags;
+  };
+
+  struct Method {
+    uint32_t address; // offset of the address pattern in the string pool
+    uint32_t address_size;
+    uint32_t types; // offset of the type tag string in the string pool
+    uint32_t types_size;
+    uint32_t next; // method added at the same node before this one
+  };
+
+  MethodIndex();
+  MethodIndex(const MethodIndex& other);
+  MethodIndex& operator=(const MethodIndex& other);
+
+  /// Adds a method with the address pattern address and the type tag string
+  /// types (empty to accept any arguments) and returns its number. Methods
+  /// are numbered from 0 in the order they are added.
+  uint32_t add(const std::string& address, const std::string& types);
+
+  /// Appends the methods whose pattern matches address, in ascending order.
+  void find(const std::string& address, std::vector<uint32_t>& methods) const;
+
+  void clear();
+
+  /// Number of methods added.
+  size_t size() const { return num_methods_; }
+
+  std::string address(uint32_t method) const;
+
+  /// Returns true if method takes messages with the type tag string types,
+  /// i.e. it has the same types or none.
+  bool accepts(uint32_t method, const std::string& types) const;
+
+  /// Writes the index to path in the byte order of this host.
+  bool save(const char* path) const;
+
+  /// Replaces the index with one written by save. The file is mapped
+  /// read-only and its arrays are used in place; only the header is checked,
+  /// so it must be a file written by save. Adding a method afterwards
+  /// copies the index out of the mapping.
+  bool load(const char* path);
+
+  /// Hash of the literal child name of parent in the edge table.
+  static uint32_t edge_hash(uint32_t parent, const char* name, size_t size);
+
+  /// Returns true if the OSC-Address address matches pattern, part by part.
+  /// '*' and the other wildcards stay within one part, and an empty part
+  /// between two slashes ("//") matches zero or more whole parts.
+  static bool match(const char* address, size_t address_size,
+      const char* pattern, size_t pattern_size);
+
+  /// Returns true if one part of an address (without '/') matches one part
+  /// of a pattern containing '?', '*', "[...]" and "{...}".
+  static bool part_match(const char* part, size_t part_size,
+      const char* pattern, size_t pattern_size);
+
+ private:
+  struct Mapping;
+
+  uint32_t add_string(const char* s, size_t size);
+  uint32_t add_child(uint32_t parent, const char* name, size_t size,
+      uint32_t flags);
+  uint32_t find_literal(uint32_t parent, const char* name, size_t size) const;
+  void grow_edges();
+  // copies a mapped index into the vectors below
+  void own();
+  // points the arrays at the vectors below
+  void refresh();
+
+  // The arrays searched by find, in the vectors below or in mapping_.
+  // Literal children are found through edges_, a linear-probing hash table
+  // of node numbers (see edge_hash) with kNone in empty slots.
+  const Node* nodes_;
+  uint32_t num_nodes_;
+  const Method* methods_;
+  uint32_t num_methods_;
+  const uint32_t* edges_;
+  uint32_t edge_slots_;
+  uint32_t num_edges_;
+  const char* strings_;
+  uint32_t strings_size_;
+
+  std::vector<Node> node_array_;
+  std::vector<Method> method_array_;
+  std::vector<uint32_t> edge_array_;
+  std::vector<char> string_array_;
+  std::tr1::shared_ptr<Mapping> mapping_;
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_INDEX__
@@ -0,0 +1,166 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-jitter.hpp
+/// @brief tnyosc jitter buffer for timetagged streams
+/// @author Toshiro Yamada
+///
+/// Bundle timetags are stamped with the sender's clock, which is offset from
+/// and drifts against the receiver's clock. ClockEstimator learns that
+/// mapping from the arrival times of timetagged messages: it keeps the
+/// smallest receive-minus-send difference in each interval (the sample with
+/// the least network delay) and fits a line through a window of those
+/// minima, giving the offset and the drift. JitterBuffer uses one estimator
+/// per source to convert timetags to local time and holds callbacks until
+/// that time plus a latency target. The target follows the measured jitter:
+/// it grows at once when messages arrive late and shrinks slowly afterwards.
+///
+/// All times are in microseconds. Local times may come from any clock (e.g.
+/// CLOCK_MONOTONIC) as long as the same clock is used for every call.
+#ifndef __TNY_OSC_JITTER__
+#define __TNY_OSC_JITTER__
+
+#include "tnyosc-dispatch.hpp"
+
+#include <deque>
+#include <list>
+#include <map>
+#include <vector>
+
+namespace tnyosc {
+
+class ClockEstimator {
+ public:
+  /// Keeps one minimum per bin_us of local time and fits the last window
+  /// minima.
+  explicit ClockEstimator(int64_t bin_us=1000000, size_t window=32);
+
+  /// Records a message stamped remote_us by the sender and received at
+  /// local_us.
+  void add(int64_t remote_us, int64_t local_us);
+
+  /// Converts a sender time to local time. Returns remote_us unchanged
+  /// before the first call to add.
+  int64_t to_local(int64_t remote_us) const;
+
+  /// Returns the estimated local minus remote time at remote_us, excluding
+  /// network delay.
+  int64_t offset(int64_t remote_us) const;
+
+  /// Returns the estimated drift of the local clock against the sender's in
+  /// parts per million.
+  double drift_ppm() const { return slope_ * 1e6; }
+
+  /// Returns the number of bins used by the fit.
+  size_t num_bins() const { return bins_.size(); }
+
+ private:
+  struct Bin {
+    int64_t start_us; // local time at which the bin was opened
+    int64_t remote_us; // sender time of the minimum
+    int64_t delta_us; // smallest local minus remote time in the bin
+  };
+
+  void fit();
+
+  int64_t bin_us_;
+  size_t window_;
+  std::deque<Bin> bins_;
+  int64_t origin_us_; // sender time the fit is centered on
+  double intercept_; // offset at origin_us_
+  double slope_;
+};
+
+// late-arrival and clock counters of one source
+struct JitterSourceStats {
+  uint64_t received; // timetagged callbacks pushed
+  uint64_t immediate; // callbacks without a timetag, released at once
+  uint64_t late; // callbacks that arrived after their release time
+  int64_t total_late_us; // sum of the lateness of late callbacks
+  int64_t max_late_us; // largest lateness
+  int64_t latency_us; // current latency target
+  int64_t offset_us; // current clock offset estimate
+  double drift_ppm; // current drift estimate
+
+  JitterSourceStats() : received(0), immediate(0), late(0), total_late_us(0),
+    max_late_us(0), latency_us(0), offset_us(0), drift_ppm(0) {}
+};
+
+class JitterBuffer {
+ public:
+  /// The latency target of each source stays within [min_latency_us,
+  /// max_latency_us] and is at least min_latency_us above the jitter.
+  JitterBuffer(int64_t min_latency_us=2000, int64_t max_latency_us=200000);
+
+  /// Queues a callback from source (e.g. the sender's address and port)
+  /// received at now_us. Callbacks without a timetag are released on the
+  /// next call to pop.
+  void push(uint64_t source, const CallbackRef& callback, int64_t now_us);
+
+  /// Moves the callbacks due at now_us to out, in release order.
+  ///
+  /// @return the number of callbacks moved.
+  size_t pop(int64_t now_us, std::list<CallbackRef>& out);
+
+  /// Returns the local time of the next release, or -1 if nothing is queued.
+  int64_t next_release() const;
+
+  /// Returns the number of queued callbacks.
+  size_t size() const { return heap_.size(); }
+
+  /// Returns a copy of the counters of source.
+  JitterSourceStats source_stats(uint64_t source) const;
+
+ private:
+  struct Source {
+    ClockEstimator clock;
+    int64_t peak_us; // jitter peak, fast attack and slow release
+    JitterSourceStats stats;
+  };
+
+  struct Entry {
+    int64_t release_us;
+    uint64_t seq; // keeps push order among equal release times
+    CallbackRef callback;
+  };
+
+  struct LaterEntry {
+    bool operator()(const Entry& a, const Entry& b) const {
+      if (a.release_us != b.release_us) return a.release_us > b.release_us;
+      return a.seq > b.seq;
+    }
+  };
+
+  int64_t min_latency_us_;
+  int64_t max_latency_us_;
+  std::map<uint64_t, Source> sources_;
+  std::vector<Entry> heap_; // min-heap on release time
+  uint64_t seq_;
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_JITTER__
@@ -0,0 +1,134 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-pack.hpp
+/// @brief tnyosc size-limited bundle packing
+/// @author Toshiro Yamada
+///
+/// BundlePacker collects messages and packs them into as few bundles as it
+/// can, each no larger than a given size (usually the UDP payload that fits
+/// in one Ethernet frame, 1472 bytes). All bundles share the same timetag.
+#ifndef __TNY_OSC_PACK__
+#define __TNY_OSC_PACK__
+
+#include "tnyosc.hpp"
+
+#include <vector>
+
+namespace tnyosc {
+
+class BundlePacker {
+ public:
+  /// Size of a bundle header ("#bundle" and the timetag).
+  static const size_t kBundleHeaderSize = 16;
+
+  /// Creates a packer producing bundles of at most max_size bytes. The
+  /// default timetag is immediate.
+  explicit BundlePacker(size_t max_size=1472)
+    : max_size_(max_size), timetag_(1), oversized_(0) {}
+  ~BundlePacker() {}
+
+  /// Sets the timetag used for all bundles created by pack.
+  ///
+  /// @param[in] ntp_time NTP Timestamp
+  void set_timetag(uint64_t ntp_time) { timetag_ = ntp_time; }
+
+  /// Queues a message to be packed. The message is copied.
+  ///
+  /// @param[in] message The OSC message.
+  /// @return false if the message cannot fit in a bundle by itself; such a
+  /// message is not queued and is counted by oversized.
+  bool append(const Message& message) {
+    if (kBundleHeaderSize + 4 + message.size() > max_size_) {
+      ++oversized_;
+      return false;
+    }
+    messages_.push_back(message);
+    return true; }
+
+  /// Packs all queued messages into bundles and appends them to bundles.
+  /// Messages are placed first-fit in order of decreasing size, which keeps
+  /// the bundle count close to the minimum; within a bundle, messages keep
+  /// the order they were appended in.
+  ///
+  /// @param[out] bundles Vector to append the packed bundles to.
+  /// @return Number of bundles appended.
+  size_t pack(std::vector<Bundle>& bundles) {
+    size_t count = messages_.size();
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), LargerMessage(messages_));
+
+    // bin i has free[i] bytes left and holds the messages in bins[i]
+    std::vector<size_t> free;
+    std::vector<std::vector<size_t> > bins;
+    for (size_t i = 0; i < count; ++i) {
+      size_t element = 4 + messages_[order[i]].size();
+      size_t bin = 0;
+      while (bin < free.size() && free[bin] < element) ++bin;
+      if (bin == free.size()) {
+        free.push_back(max_size_ - kBundleHeaderSize);
+        bins.push_back(std::vector<size_t>());
+      }
+      free[bin] -= element;
+      bins[bin].push_back(order[i]);
+    }
+
+    for (size_t bin = 0; bin < bins.size(); ++bin) {
+      std::sort(bins[bin].begin(), bins[bin].end());
+      bundles.push_back(Bundle());
+      Bundle& bundle = bundles.back();
+      bundle.set_timetag(timetag_);
+      for (size_t i = 0; i < bins[bin].size(); ++i) {
+        bundle.append(messages_[bins[bin][i]]);
+      }
+    }
+    messages_.clear();
+    return bins.size(); }
+
+  /// Returns the number of messages waiting to be packed.
+  size_t pending() const { return messages_.size(); }
+
+  /// Returns the number of messages rejected by append for being too large.
+  uint64_t oversized() const { return oversized_; }
+
+ private:
+  struct LargerMessage {
+    const std::vector<Message>& messages;
+    explicit LargerMessage(const std::vector<Message>& m) : messages(m) {}
+    bool operator()(size_t a, size_t b) const {
+      return messages[a].size() > messages[b].size(); }
+  };
+
+  size_t max_size_;
+  uint64_t timetag_;
+  std::vector<Message> messages_;
+  uint64_t oversized_;
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_PACK__
@@ -0,0 +1,84 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-pool.hpp
+/// @brief tnyosc worker thread pool
+/// @author Toshiro Yamada
+///
+/// WorkerPool is a small fixed-size pool of POSIX threads used by
+/// Dispatcher::match_methods_parallel. It runs one batch of indexed tasks at a
+/// time, with the calling thread taking part in the work.
+#ifndef __TNY_OSC_POOL__
+#define __TNY_OSC_POOL__
+
+#include <cstddef>
+#include <vector>
+
+#include <pthread.h>
+
+namespace tnyosc {
+
+class WorkerPool {
+ public:
+  typedef void (*task_function)(void* arg, size_t index);
+
+  /// Starts num_threads worker threads. With 0 threads, run executes every
+  /// task on the calling thread.
+  explicit WorkerPool(size_t num_threads);
+  ~WorkerPool();
+
+  /// Returns the number of worker threads, not counting the caller.
+  size_t size() const { return threads_.size(); }
+
+  /// Calls task(arg, i) for each i in [0, count) and returns when all calls
+  /// have finished. Calls may run in any order and concurrently. run must not
+  /// be called from more than one thread at a time.
+  void run(task_function task, void* arg, size_t count);
+
+ private:
+  WorkerPool(const WorkerPool&);
+  WorkerPool& operator=(const WorkerPool&);
+
+  static void* thread_main(void* pool);
+  void work();
+
+  std::vector<pthread_t> threads_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t start_cond_;
+  pthread_cond_t done_cond_;
+  unsigned int generation_; // incremented for each batch
+  size_t busy_; // workers that have not finished the current batch
+  bool stop_;
+
+  task_function task_;
+  void* arg_;
+  size_t count_;
+  size_t next_; // next index to run, taken with an atomic add
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_POOL__
@@ -0,0 +1,151 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-queue.hpp
+/// @brief tnyosc bounded receive queue with priority classes
+/// @author Toshiro Yamada
+///
+/// ReceiveQueue sits between packet receipt and a Dispatcher. Packets are
+/// split into messages, and each message is queued in a priority class chosen
+/// by matching its address against the class patterns. Every class has a
+/// bounded queue with its own overflow policy, and dispatch always serves the
+/// most urgent non-empty class first, so a flood of low-priority messages
+/// cannot delay critical ones by more than one message. push and dispatch may
+/// be called from different threads.
+#ifndef __TNY_OSC_QUEUE__
+#define __TNY_OSC_QUEUE__
+
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+#include <pthread.h>
+
+namespace tnyosc {
+
+// what a full class does with a new message
+enum OverflowPolicy {
+  kDropOldest, // discard the oldest queued message
+  kDropNewest, // discard the new message
+  kLatestPerAddress // replace the queued message with the same address in
+                    // place; drop the oldest if the address is not queued
+};
+
+// counters kept for each priority class
+struct QueueClassStats {
+  uint64_t enqueued; // messages accepted into the queue
+  uint64_t dispatched; // messages passed to the dispatcher
+  uint64_t dropped; // messages discarded by the overflow policy
+  uint64_t replaced; // queued messages overwritten by a newer value
+  uint64_t total_wait_ns; // sum of the queueing delay of dispatched messages
+  uint64_t max_wait_ns; // longest queueing delay
+  size_t depth; // messages currently queued
+
+  QueueClassStats() : enqueued(0), dispatched(0), dropped(0), replaced(0),
+    total_wait_ns(0), max_wait_ns(0), depth(0) {}
+};
+
+class ReceiveQueue {
+ public:
+  ReceiveQueue();
+  ~ReceiveQueue();
+
+  /// Adds a priority class holding at most capacity messages and returns its
+  /// id. Classes with a higher priority are dispatched first; classes with
+  /// the same priority are served in the order they were added. Messages
+  /// whose address matches no class go to the first class added.
+  size_t add_class(int priority, size_t capacity, OverflowPolicy policy);
+
+  /// Sends messages whose address matches pattern (see
+  /// Dispatcher::pattern_match) to class id. Patterns are tried in the order
+  /// they were assigned.
+  void assign(size_t id, const char* pattern);
+
+  /// Queues every message of a raw packet. Messages in a bundle keep the
+  /// bundle's timetag.
+  ///
+  /// @return false if the packet is malformed or no class was added; nothing
+  /// is queued in that case.
+  bool push(const char* data, size_t size);
+
+  /// Matches and invokes up to max_messages queued messages, most urgent
+  /// class first. Methods are called without holding the queue lock.
+  ///
+  /// @return the number of messages dispatched.
+  size_t dispatch(Dispatcher& dispatcher, size_t max_messages=64);
+
+  /// Returns the number of queued messages in all classes.
+  size_t size() const;
+
+  /// Returns a copy of the counters of class id.
+  QueueClassStats class_stats(size_t id) const;
+
+ private:
+  ReceiveQueue(const ReceiveQueue&);
+  ReceiveQueue& operator=(const ReceiveQueue&);
+
+  struct Item {
+    std::string address;
+    ByteArray data; // the raw message
+    struct timeval timetag;
+    uint64_t enqueue_ns;
+  };
+
+  struct Class {
+    int priority;
+    size_t capacity;
+    OverflowPolicy policy;
+    std::deque<Item> items;
+    // kLatestPerAddress: address to sequence number of its queued item
+    std::tr1::unordered_map<std::string, uint64_t> latest;
+    uint64_t front_seq; // sequence number of items.front()
+    QueueClassStats stats;
+  };
+
+  struct Route {
+    std::string pattern;
+    size_t id;
+  };
+
+  size_t find_class(const std::string& address) const;
+  void enqueue(Class& c, const PacketElement& element,
+      const std::string& address, uint64_t now);
+  void pop_front(Class& c);
+
+  mutable pthread_mutex_t mutex_;
+  std::vector<Class> classes_;
+  std::vector<size_t> order_; // class ids, most urgent first
+  std::vector<Route> routes_;
+  std::vector<PacketElement> elements_; // reused by push
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_QUEUE__
@@ -0,0 +1,121 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-router.hpp
+/// @brief tnyosc packet router
+/// @author Toshiro Yamada
+///
+/// Router forwards received OSC messages to subscribers by address pattern
+/// without decoding their arguments. Only the bundle structure and each
+/// message's address are read; the message bytes are copied unchanged into a
+/// per-subscriber output bundle. Messages that arrived inside a timed bundle
+/// are wrapped in a sub-bundle with the same timetag, so scheduling is kept.
+/// Output is batched and handed to the subscriber's sink when it reaches the
+/// packet size limit or on flush.
+#ifndef __TNY_OSC_ROUTER__
+#define __TNY_OSC_ROUTER__
+
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+namespace tnyosc {
+
+/// Receives the packets produced for a subscriber, e.g. to send them on a
+/// socket. data is only valid during the call.
+typedef void (*packet_sink)(const char* data, size_t size, void* user_data);
+
+struct RouterStats {
+  uint64_t packets; // packets passed to route
+  uint64_t malformed; // packets rejected by route
+  uint64_t messages; // messages found in routed packets
+  uint64_t forwarded; // message copies queued for subscribers
+  uint64_t sent; // packets handed to sinks
+
+  RouterStats() : packets(0), malformed(0), messages(0), forwarded(0),
+    sent(0) {}
+};
+
+class Router {
+ public:
+  /// Creates a router whose output packets are at most max_packet_size
+  /// bytes, unless a single message is larger.
+  explicit Router(size_t max_packet_size=1472);
+
+  /// Adds a subscriber and returns its id for subscribe.
+  size_t add_subscriber(packet_sink sink, void* user_data);
+
+  /// Forwards messages whose address matches pattern (see
+  /// Dispatcher::pattern_match) to subscriber. A message matching several
+  /// patterns of the same subscriber is forwarded once.
+  void subscribe(size_t subscriber, const char* pattern);
+
+  /// Queues every message in a raw packet for the matching subscribers.
+  ///
+  /// @return false if the packet is malformed; nothing is forwarded then.
+  bool route(const char* data, size_t size);
+
+  /// Hands all queued output to the sinks.
+  void flush();
+
+  const RouterStats& stats() const { return stats_; }
+
+ private:
+  struct Subscriber {
+    packet_sink sink;
+    void* user_data;
+    std::vector<std::string> patterns;
+    ByteArray buffer; // outer bundle being filled
+    size_t num_elements; // elements in buffer
+    size_t timed_offset; // offset of the open sub-bundle, or 0 if none
+  };
+
+  struct Element {
+    const char* data;
+    size_t size;
+    const char* timetag; // 8 raw bytes, or NULL if not in a timed bundle
+  };
+
+  static bool index_elements(const char* data, size_t size,
+      const char* timetag, std::vector<Element>& elements);
+  const std::vector<uint32_t>& find_subscribers(const char* address);
+  void queue(Subscriber& subscriber, const Element& element);
+  void send(Subscriber& subscriber);
+
+  size_t max_packet_size_;
+  std::vector<Subscriber> subscribers_;
+  // address to subscriber ids, cleared by subscribe and when it grows large
+  std::tr1::unordered_map<std::string, std::vector<uint32_t> > matches_;
+  std::vector<Element> elements_; // reused by route
+  RouterStats stats_;
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_ROUTER__
@@ -0,0 +1,165 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-schema.hpp
+/// @brief tnyosc compile-time message schemas
+/// @author Toshiro Yamada
+///
+/// A Schema describes a message whose address and argument types are fixed:
+///
+/// <pre>
+///   typedef tnyosc::Schema<"/mixer/ch/level", int32_t, float> Level;
+///   char buf[Level::size];
+///   Level::encode(buf, 3, 0.8f);
+///
+///   int32_t ch; float level;
+///   if (Level::decode(data, size, ch, level)) { ... }
+/// </pre>
+///
+/// The padded address and type tag header is built at compile time, so
+/// encoding is a copy of the header followed by byte-swapped stores of the
+/// arguments at fixed offsets, and decoding is one size check, one header
+/// comparison and the matching loads. The bytes are identical to those of an
+/// equivalent tnyosc::Message. This header requires C++20.
+#ifndef __TNY_OSC_SCHEMA__
+#define __TNY_OSC_SCHEMA__
+
+#if __cplusplus >= 202002L
+
+#include "tnyosc-audit.hpp"
+#include "tnyosc.hpp"
+
+#include <array>
+#include <cstring>
+
+namespace tnyosc {
+
+/// String literal usable as a template argument.
+template <size_t N>
+struct FixedString {
+  char value[N];
+  constexpr FixedString(const char (&s)[N]) {
+    for (size_t i = 0; i < N; ++i) value[i] = s[i];
+  }
+  /// Length without the terminating null character.
+  static constexpr size_t length = N - 1;
+};
+
+/// Type tag and encoding of each argument type a Schema accepts.
+template <class T> struct SchemaArg;
+
+template <> struct SchemaArg<int32_t> {
+  static constexpr char tag = 'i';
+  static constexpr size_t size = 4;
+  static void store(char* p, int32_t v) { swap_copy32(p, &v, 1); }
+  static void load(const char* p, int32_t& v) { swap_copy32(&v, p, 1); }
+};
+
+template <> struct SchemaArg<float> {
+  static constexpr char tag = 'f';
+  static constexpr size_t size = 4;
+  static void store(char* p, float v) { swap_copy32(p, &v, 1); }
+  static void load(const char* p, float& v) { swap_copy32(&v, p, 1); }
+};
+
+template <> struct SchemaArg<int64_t> {
+  static constexpr char tag = 'h';
+  static constexpr size_t size = 8;
+  static void store(char* p, int64_t v) { swap_copy64(p, &v, 1); }
+  static void load(const char* p, int64_t& v) { swap_copy64(&v, p, 1); }
+};
+
+template <> struct SchemaArg<double> {
+  static constexpr char tag = 'd';
+  static constexpr size_t size = 8;
+  static void store(char* p, double v) { swap_copy64(p, &v, 1); }
+  static void load(const char* p, double& v) { swap_copy64(&v, p, 1); }
+};
+
+template <FixedString Address, class... Args>
+class Schema {
+ public:
+  /// Size of an OSC-string of length n, including its null padding.
+  static constexpr size_t padded(size_t n) { return n + (4 - n % 4); }
+
+  static constexpr size_t address_size = padded(Address.length);
+  static constexpr size_t types_size = padded(1 + sizeof...(Args));
+  static constexpr size_t header_size = address_size + types_size;
+  static constexpr size_t args_size = (SchemaArg<Args>::size + ... + 0);
+  /// Size of every encoded message of this schema.
+  static constexpr size_t size = header_size + args_size;
+
+  typedef std::array<char, size> Buffer;
+
+  /// Padded address followed by the padded type tag string.
+  static constexpr std::array<char, header_size> header = [] {
+    std::array<char, header_size> h{};
+    for (size_t i = 0; i < Address.length; ++i) h[i] = Address.value[i];
+    const char tags[] = {',', SchemaArg<Args>::tag...};
+    for (size_t i = 0; i < sizeof(tags); ++i) h[address_size + i] = tags[i];
+    return h;
+  }();
+
+  /// Writes a complete message into buf, which must hold size bytes.
+  ///
+  /// @return size
+  static size_t encode(char* buf, Args... args) {
+    TNYOSC_AUDIT_SCOPE("Schema::encode");
+    memcpy(buf, header.data(), header_size);
+    char* p = buf + header_size;
+    ((SchemaArg<Args>::store(p, args), p += SchemaArg<Args>::size), ...);
+    return size;
+  }
+
+  /// Returns the encoded message in a fixed-size array.
+  static Buffer encode(Args... args) {
+    Buffer buf;
+    encode(buf.data(), args...);
+    return buf;
+  }
+
+  /// Returns true if data is a message of this schema.
+  static bool matches(const char* data, size_t data_size) {
+    return data_size == size && !memcmp(data, header.data(), header_size);
+  }
+
+  /// Reads the arguments of a message of this schema.
+  ///
+  /// @return false if data has a different address, type tags or size.
+  static bool decode(const char* data, size_t data_size, Args&... args) {
+    TNYOSC_AUDIT_SCOPE("Schema::decode");
+    if (!matches(data, data_size)) return false;
+    const char* p = data + header_size;
+    ((SchemaArg<Args>::load(p, args), p += SchemaArg<Args>::size), ...);
+    return true;
+  }
+};
+
+} // namespace tnyosc
+
+#endif // __cplusplus >= 202002L
+
+#endif // __TNY_OSC_SCHEMA__
@@ -0,0 +1,114 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-server.hpp
+/// @brief tnyosc multi-threaded UDP receiver
+/// @author Toshiro Yamada
+///
+/// ShardedServer receives OSC packets on one UDP port with several sockets
+/// bound through SO_REUSEPORT. The kernel hashes each sender to one socket, so
+/// packets from a sender are always handled in order by the same shard while
+/// different senders are spread across threads. Every shard owns a
+/// Dispatcher built from the same list of methods and invokes the matched
+/// methods on its own thread, so methods must be safe to call concurrently.
+#ifndef __TNY_OSC_SERVER__
+#define __TNY_OSC_SERVER__
+
+#include "tnyosc-dispatch.hpp"
+
+#include <vector>
+
+#include <pthread.h>
+
+namespace tnyosc {
+
+// counters kept by each shard
+struct ShardStats {
+  uint64_t packets; // packets received
+  uint64_t bytes; // bytes received
+  uint64_t callbacks; // methods invoked
+  uint64_t unmatched; // packets that failed to decode or matched no method
+
+  ShardStats() : packets(0), bytes(0), callbacks(0), unmatched(0) {}
+};
+
+class ShardedServer {
+ public:
+  ShardedServer();
+  /// Stops the server if it is running.
+  ~ShardedServer();
+
+  /// Adds a method to the registration list shared by all shards. Methods
+  /// must be added before calling start.
+  void add_method(const char* address, const char* types,
+      osc_method method, void* user_data);
+
+  /// Opens num_shards UDP sockets on port and starts one receive thread per
+  /// socket. If port is 0, a free port is chosen; see port. If pin_threads is
+  /// true, shard i is pinned to CPU i (modulo the number of CPUs) where the
+  /// platform supports it.
+  ///
+  /// @return false if a socket could not be opened or bound.
+  bool start(uint16_t port, size_t num_shards, bool pin_threads=false);
+
+  /// Stops all receive threads and closes the sockets.
+  void stop();
+
+  /// Returns the bound UDP port, or 0 if the server is not running.
+  uint16_t port() const { return port_; }
+
+  /// Returns the number of running shards.
+  size_t num_shards() const { return shards_.size(); }
+
+  /// Returns a copy of the counters of a shard. Safe to call while running.
+  ShardStats shard_stats(size_t shard) const;
+
+ private:
+  ShardedServer(const ShardedServer&);
+  ShardedServer& operator=(const ShardedServer&);
+
+  struct Shard {
+    ShardedServer* server;
+    size_t index;
+    int fd;
+    pthread_t thread;
+    Dispatcher dispatcher;
+    ShardStats stats;
+  };
+
+  static void* shard_main(void* shard);
+  static int open_socket(uint16_t port);
+
+  std::vector<MethodTemplate> methods_;
+  std::vector<Shard*> shards_;
+  uint16_t port_;
+  bool pin_threads_;
+  int stop_; // set with atomic builtins, read by the receive threads
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_SERVER__
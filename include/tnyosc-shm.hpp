@@ -0,0 +1,140 @@
+// Copyright (c) 2011 Toshiro Yamada
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file tnyosc-shm.hpp
+/// @brief tnyosc shared-memory transport
+/// @author Toshiro Yamada
+///
+/// ShmRing passes OSC packets between processes on the same host through a
+/// named POSIX shared-memory ring (shm_open and mmap), avoiding the system
+/// calls and copies of loopback UDP. Any number of threads or processes may
+/// write; a single reader consumes packets in place, so a Dispatcher decodes
+/// them straight from the shared memory. An idle reader sleeps on a futex in
+/// the ring and is woken by the next writer.
+///
+/// Each packet is stored as an 8-byte record header followed by the packet,
+/// padded to 8 bytes. Writers reserve space with an atomic compare-and-swap
+/// and publish the record by setting its header, so a slow writer delays
+/// only the packets reserved after its own.
+#ifndef __TNY_OSC_SHM__
+#define __TNY_OSC_SHM__
+
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+namespace tnyosc {
+
+struct ShmRingHeader;
+
+class ShmRing {
+ public:
+  ShmRing();
+  /// Unmaps the ring. The shared-memory object is kept; see unlink.
+  ~ShmRing();
+
+  /// Creates the shared-memory object name (e.g. "/synth") holding a ring of
+  /// at least capacity bytes, replacing any previous ring of that name.
+  ///
+  /// @return false if the object could not be created or mapped.
+  bool create(const char* name, size_t capacity);
+
+  /// Maps an existing ring created by another process.
+  ///
+  /// @return false if the object does not exist or is not a ring.
+  bool open(const char* name);
+
+  /// Unmaps the ring.
+  void close();
+
+  /// Removes the shared-memory object name. Mapped rings stay valid.
+  static bool unlink(const char* name);
+
+  /// Returns true if a ring is mapped.
+  bool is_open() const { return header_ != NULL; }
+
+  /// Returns the number of bytes available for records.
+  size_t capacity() const;
+
+  /// Reserves size bytes for a packet and returns a pointer to them in the
+  /// ring, or NULL if the ring is full. The packet is not visible to the
+  /// reader until commit is called with the returned pointer. Safe to call
+  /// from several threads and processes.
+  char* reserve(size_t size);
+
+  /// Publishes a packet written into memory returned by reserve and wakes
+  /// the reader if it is waiting.
+  void commit(char* packet);
+
+  /// Copies a packet into the ring.
+  ///
+  /// @return false if the ring is full.
+  bool write(const char* data, size_t size) {
+    char* p = reserve(size);
+    if (p == NULL) return false;
+    memcpy(p, data, size);
+    commit(p);
+    return true;
+  }
+  bool write(const Message& message) {
+    return write(message.data(), message.size()); }
+  bool write(const Bundle& bundle) {
+    return write(bundle.data(), bundle.size()); }
+
+  /// Returns the oldest packet in the ring, or NULL if there is none. The
+  /// packet stays in the ring until release is called. Only one thread may
+  /// read a ring.
+  const char* peek(size_t* size);
+
+  /// Frees the packet returned by the last call to peek.
+  void release();
+
+  /// Blocks until a packet is available or timeout_ms milliseconds pass. A
+  /// negative timeout waits forever.
+  ///
+  /// @return true if a packet is available.
+  bool wait(int timeout_ms=-1);
+
+  /// Matches up to max_packets packets against the methods of dispatcher
+  /// and invokes the callbacks in order, decoding directly from the ring.
+  ///
+  /// @return the number of packets consumed.
+  size_t dispatch(Dispatcher& dispatcher, size_t max_packets=64);
+
+ private:
+  ShmRing(const ShmRing&);
+  ShmRing& operator=(const ShmRing&);
+
+  bool map(int fd, size_t size);
+
+  ShmRingHeader* header_;
+  char* data_; // first record byte, capacity() bytes
+  size_t map_size_;
+  size_t peek_size_; // record size of the peeked packet, or 0
+};
+
+} // namespace tnyosc
+
+#endif // __TNY_OSC_SHM__
@@ -54,6 +54,7 @@
 #endif
 
 #include <cstddef> // size_t
+#include <cstring> // memcpy
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -63,6 +64,10 @@
 #include <boost/shared_ptr.hpp>
 #endif
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h> // _mm_shuffle_epi8
+#endif
+
 #if defined(_WIN32) || defined(_WIN64)
   #if (_MSC_VER < 1300)
     typedef signed char       int8_t;
@@ -108,6 +113,52 @@ inline double ntohf(int32_t x) { x = ntohl(x); return *(float*)&x; }
 /// Convert 64-bit big-endian network format to double
 inline double ntohd(int64_t x) { return (double)ntohll(x); }
 
+/// Copies n 32-bit values from src to dst, converting between host and
+/// network byte order. src and dst may be unaligned but must not overlap.
+inline void swap_copy32(void* dst, const void* src, size_t n)
+{
+  char* d = (char*)dst;
+  const char* s = (const char*)src;
+  size_t i = 0;
+#if defined(__SSSE3__)
+  const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                                    4, 5, 6, 7, 0, 1, 2, 3);
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(s + i * 4));
+    _mm_storeu_si128((__m128i*)(d + i * 4), _mm_shuffle_epi8(v, mask));
+  }
+#endif
+  for (; i < n; ++i) {
+    uint32_t v;
+    memcpy(&v, s + i * 4, 4);
+    v = htonl(v);
+    memcpy(d + i * 4, &v, 4);
+  }
+}
+
+/// Copies n 64-bit values from src to dst, converting between host and
+/// network byte order. src and dst may be unaligned but must not overlap.
+inline void swap_copy64(void* dst, const void* src, size_t n)
+{
+  char* d = (char*)dst;
+  const char* s = (const char*)src;
+  size_t i = 0;
+#if defined(__SSSE3__)
+  const __m128i mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                                    0, 1, 2, 3, 4, 5, 6, 7);
+  for (; i + 2 <= n; i += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(s + i * 8));
+    _mm_storeu_si128((__m128i*)(d + i * 8), _mm_shuffle_epi8(v, mask));
+  }
+#endif
+  for (; i < n; ++i) {
+    uint64_t v;
+    memcpy(&v, s + i * 8, 8);
+    v = htonll(v);
+    memcpy(d + i * 8, &v, 8);
+  }
+}
+
 /// A byte array type internally used in the tnyosc library.
 typedef std::vector<char> ByteArray;
 
@@ -225,17 +276,13 @@ class Message {
     is_cached_ = false;
     types_.push_back('i');
     int32_t a = htonl(v);
-    ByteArray b(4);
-    memcpy(&b[0], (char*)&a, 4);
-    data_.insert(data_.end(), b.begin(), b.end()); }
+    append_bytes(&a, 4); }
   // float32
   void append(float v) {
     is_cached_ = false;
     types_.push_back('f');
     int32_t a = htonf(v);
-    ByteArray b(4);
-    memcpy(&b[0], (char*)&a, 4);
-    data_.insert(data_.end(), b.begin(), b.end()); }
+    append_bytes(&a, 4); }
   // OSC-string
   void append(const std::string& v) {
     is_cached_ = false;
@@ -269,12 +316,9 @@ class Message {
   void append_time(uint64_t v) {
     is_cached_ = false;
     types_.push_back('t');
-    uint64_t sec = htonl((uint32_t)(v >> 32));
-    uint64_t frac = htonl((uint32_t)v);
-    uint64_t a = sec << 32 | frac;
-    ByteArray b(8);
-    memcpy(&b[0], (char*)&a, 8);
-    data_.insert(data_.end(), b.begin(), b.end()); }
+    // seconds in the first 4 bytes, fraction in the last 4
+    uint64_t a = htonll(v);
+    append_bytes(&a, 8); }
   // appends the current UTP timestamp
   void append_current_time() { append_time(get_current_ntp_time()); }
   // True
@@ -294,25 +338,19 @@ class Message {
     is_cached_ = false;
     types_.push_back('h');
     int64_t a = htonll(v);
-    ByteArray b(8);
-    memcpy(&b[0], (char*)&a, 8);
-    data_.insert(data_.end(), b.begin(), b.end()); }
+    append_bytes(&a, 8); }
   // float64 (or double)
   void append(double v) {
     is_cached_ = false;
     types_.push_back('d');
     int64_t a = htond(v);
-    ByteArray b(8);
-    memcpy(&b[0], (char*)&a, 8);
-    data_.insert(data_.end(), b.begin(), b.end()); }
+    append_bytes(&a, 8); }
   // ascii character
   void append(char v) {
     is_cached_ = false;
     types_.push_back('c');
     int32_t a = htonl(v);
-    ByteArray b(4);
-    memcpy(&b[0], (char*)&a, 4);
-    data_.insert(data_.end(), b.begin(), b.end()); }
+    append_bytes(&a, 4); }
   // midi
   void append_midi(uint8_t port, uint8_t status, uint8_t data1, uint8_t data2) {
     is_cached_ = false;
@@ -323,13 +361,48 @@ class Message {
     b[2] = data1;
     b[3] = data2;
     data_.insert(data_.end(), b.begin(), b.end()); }
-  // array
-  void append_array(void* array, size_t size) {
-    if (!array || size == 0) return;
+  // @}
+
+  // @{
+  /// @name Functions for adding arrays and runs of numbers
+  /// append_int32s, append_floats and append_doubles add n separate arguments
+  /// in one pass; append_array adds the same values enclosed in an OSC array.
+  /// Any other types may be put in an array between begin_array and
+  /// end_array.
+  // array start
+  void begin_array() { is_cached_ = false; types_.push_back('['); }
+  // array end
+  void end_array() { is_cached_ = false; types_.push_back(']'); }
+  // int32 run
+  void append_int32s(const int32_t* v, size_t n) {
     is_cached_ = false;
-    types_.push_back('[');
-    types_.insert(types_.end(), (uint8_t*)&array, (uint8_t*)&array + size);
-    types_.push_back(']'); }
+    types_.insert(types_.end(), n, 'i');
+    size_t offset = data_.size();
+    data_.resize(offset + n * 4);
+    if (n > 0) swap_copy32(&data_[offset], v, n); }
+  // float32 run
+  void append_floats(const float* v, size_t n) {
+    is_cached_ = false;
+    types_.insert(types_.end(), n, 'f');
+    size_t offset = data_.size();
+    data_.resize(offset + n * 4);
+    if (n > 0) swap_copy32(&data_[offset], v, n); }
+  // float64 run
+  void append_doubles(const double* v, size_t n) {
+    is_cached_ = false;
+    types_.insert(types_.end(), n, 'd');
+    size_t offset = data_.size();
+    data_.resize(offset + n * 8);
+    if (n > 0) swap_copy64(&data_[offset], v, n); }
+  // int32 array
+  void append_array(const int32_t* v, size_t n) {
+    begin_array(); append_int32s(v, n); end_array(); }
+  // float32 array
+  void append_array(const float* v, size_t n) {
+    begin_array(); append_floats(v, n); end_array(); }
+  // float64 array
+  void append_array(const double* v, size_t n) {
+    begin_array(); append_doubles(v, n); end_array(); }
   // @}
 
   /// Sets the OSC address of this message.
@@ -343,6 +416,9 @@ class Message {
   /// Returns the OSC address of this message.
   const std::string& address() const { return address_; }
 
+  /// Returns the OSC type tag string of this message, starting with ','.
+  const ByteArray& types() const { return types_; }
+
   /// Returns a complete byte array of this OSC message as a ByteArray type.
   /// The byte array is constructed lazily and is cached until the cache is
   /// obsolete. Call to |data| and |size| perform the same caching.
@@ -390,6 +466,10 @@ class Message {
   mutable bool is_cached_;
   mutable ByteArray cache_;
 
+  /// Appends raw bytes to the argument data.
+  void append_bytes(const void* bytes, size_t size) {
+    data_.insert(data_.end(), (const char*)bytes, (const char*)bytes + size); }
+
   /// Create the OSC message and store it in cache.
   const ByteArray& create_cache() const {
     is_cached_ = true;
@@ -449,12 +529,10 @@ class Bundle {
   /// @param[in] ntp_time NTP Timestamp
   /// @see get_current_ntp_time
   void set_timetag(uint64_t ntp_time) {
-    uint64_t sec = htonl((uint32_t)(ntp_time >> 32));
-    uint64_t frac = htonl((uint32_t)ntp_time);
-    uint64_t a = sec << 32 | frac;
-    ByteArray b(8);
-    memcpy(&b[0], (char*)&a, 8);
-    data_.insert(data_.begin()+8, b.begin(), b.end()); }
+    // seconds in the first 4 bytes, fraction in the last 4
+    uint64_t a = htonll(ntp_time);
+    // overwrite the immediate timetag written by the constructor
+    memcpy(&data_[8], (char*)&a, 8); }
 
   /// Returns a complete byte array of this OSC bundle as a tnyosc::ByteArray
   /// type.
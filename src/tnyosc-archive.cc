@@ -0,0 +1,317 @@
+
+#include "tnyosc-archive.hpp"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace tnyosc;
+
+static void reset_block(ArchiveCheckpoint& block)
+{
+  block.min_time = (uint64_t)-1;
+  block.max_time = 0;
+  block.addresses = 0;
+  block.num_addresses = 0;
+  block.reserved = 0;
+}
+
+ArchiveWriter::ArchiveWriter()
+  : data_file_(NULL), index_file_(NULL), address_file_(NULL),
+    checkpoint_file_(NULL), block_file_(NULL), data_size_(0),
+    num_entries_(0), num_block_ids_(0)
+{
+  reset_block(block_);
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+  close();
+}
+
+bool ArchiveWriter::open(const std::string& base)
+{
+  close();
+  data_file_ = fopen((base + ".dat").c_str(), "ab");
+  index_file_ = fopen((base + ".idx").c_str(), "a+b");
+  address_file_ = fopen((base + ".adr").c_str(), "a+b");
+  checkpoint_file_ = fopen((base + ".ckp").c_str(), "ab");
+  block_file_ = fopen((base + ".blk").c_str(), "ab");
+  if (!data_file_ || !index_file_ || !address_file_ || !checkpoint_file_ ||
+      !block_file_) {
+    close();
+    return false;
+  }
+
+  fseek(data_file_, 0, SEEK_END);
+  data_size_ = ftell(data_file_);
+  fseek(block_file_, 0, SEEK_END);
+  num_block_ids_ = ftell(block_file_) / sizeof(uint32_t);
+
+  // reload the address table so ids keep counting from the existing ones
+  rewind(address_file_);
+  std::string address;
+  int c;
+  while ((c = fgetc(address_file_)) != EOF) {
+    if (c == '\0') {
+      uint32_t id = address_ids_.size();
+      address_ids_.insert(std::make_pair(address, id));
+      address.clear();
+    } else {
+      address.push_back((char)c);
+    }
+  }
+  // stdio needs a seek between reading and writing the same stream
+  fseek(address_file_, 0, SEEK_END);
+
+  // recover the time range and addresses of the last, unfinished checkpoint
+  // block
+  fseek(index_file_, 0, SEEK_END);
+  num_entries_ = ftell(index_file_) / sizeof(ArchiveIndexEntry);
+  uint64_t partial = num_entries_ % kArchiveCheckpointInterval;
+  fseek(index_file_, (num_entries_ - partial) * sizeof(ArchiveIndexEntry),
+      SEEK_SET);
+  for (uint64_t i = 0; i < partial; ++i) {
+    ArchiveIndexEntry entry;
+    if (fread(&entry, sizeof(entry), 1, index_file_) != 1) break;
+    if (entry.time < block_.min_time) block_.min_time = entry.time;
+    if (entry.time > block_.max_time) block_.max_time = entry.time;
+    block_ids_.push_back(entry.address_id);
+  }
+  fseek(index_file_, 0, SEEK_END);
+  return true;
+}
+
+void ArchiveWriter::close()
+{
+  FILE** files[] = {&data_file_, &index_file_, &address_file_,
+    &checkpoint_file_, &block_file_};
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+    if (*files[i]) fclose(*files[i]);
+    *files[i] = NULL;
+  }
+  data_size_ = 0;
+  num_entries_ = 0;
+  num_block_ids_ = 0;
+  address_ids_.clear();
+  reset_block(block_);
+  block_ids_.clear();
+}
+
+uint32_t ArchiveWriter::intern(const char* address)
+{
+  std::map<std::string, uint32_t>::iterator it = address_ids_.find(address);
+  if (it != address_ids_.end()) return it->second;
+  uint32_t id = address_ids_.size();
+  address_ids_.insert(std::make_pair(std::string(address), id));
+  fwrite(address, strlen(address) + 1, 1, address_file_);
+  return id;
+}
+
+bool ArchiveWriter::append(const char* data, size_t size,
+    uint64_t receive_time)
+{
+  if (!data_file_) return false;
+
+  std::vector<PacketElement> elements;
+  if (!Dispatcher::index_packet(data, size, elements)) return false;
+  for (size_t i = 0; i < elements.size(); ++i) {
+    const PacketElement& e = elements[i];
+    if (e.size == 0 || memchr(e.data, '\0', e.size) == NULL) return false;
+  }
+
+  if (fwrite(data, size, 1, data_file_) != 1) return false;
+
+  for (size_t i = 0; i < elements.size(); ++i) {
+    const PacketElement& e = elements[i];
+    ArchiveIndexEntry entry;
+    bool immediate = e.timetag.tv_sec == 0 && e.timetag.tv_usec == 0;
+    entry.time = immediate ? receive_time : unixtime_to_ntp(e.timetag);
+    entry.offset = data_size_ + (e.data - data);
+    entry.size = e.size;
+    entry.address_id = intern(e.data);
+    if (fwrite(&entry, sizeof(entry), 1, index_file_) != 1) return false;
+
+    if (entry.time < block_.min_time) block_.min_time = entry.time;
+    if (entry.time > block_.max_time) block_.max_time = entry.time;
+    block_ids_.push_back(entry.address_id);
+    if (++num_entries_ % kArchiveCheckpointInterval == 0) {
+      std::sort(block_ids_.begin(), block_ids_.end());
+      block_ids_.erase(std::unique(block_ids_.begin(), block_ids_.end()),
+          block_ids_.end());
+      block_.addresses = num_block_ids_;
+      block_.num_addresses = block_ids_.size();
+      // ids first, so a checkpoint never refers past the end of .blk
+      if (fwrite(&block_ids_[0], sizeof(uint32_t), block_ids_.size(),
+            block_file_) != block_ids_.size() ||
+          fwrite(&block_, sizeof(block_), 1, checkpoint_file_) != 1) {
+        return false;
+      }
+      num_block_ids_ += block_ids_.size();
+      reset_block(block_);
+      block_ids_.clear();
+    }
+  }
+  data_size_ += size;
+  return true;
+}
+
+bool ArchiveWriter::flush()
+{
+  if (!data_file_) return false;
+  // data first, so an index entry never points past the end of the data
+  return fflush(data_file_) == 0 && fflush(address_file_) == 0 &&
+    fflush(index_file_) == 0 && fflush(block_file_) == 0 &&
+    fflush(checkpoint_file_) == 0;
+}
+
+ArchiveReader::ArchiveReader()
+  : num_entries_(0), num_checkpoints_(0)
+{
+  data_.address = index_.address = checkpoints_.address = NULL;
+  blocks_.address = NULL;
+  data_.size = index_.size = checkpoints_.size = blocks_.size = 0;
+}
+
+ArchiveReader::~ArchiveReader()
+{
+  close();
+}
+
+bool ArchiveReader::map_file(const std::string& path, Mapping& mapping)
+{
+  mapping.address = NULL;
+  mapping.size = 0;
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    mapping.address = p;
+    mapping.size = st.st_size;
+  }
+  ::close(fd);
+  return true;
+}
+
+void ArchiveReader::unmap_file(Mapping& mapping)
+{
+  if (mapping.address) munmap(mapping.address, mapping.size);
+  mapping.address = NULL;
+  mapping.size = 0;
+}
+
+bool ArchiveReader::open(const std::string& base)
+{
+  close();
+  Mapping addresses;
+  if (!map_file(base + ".dat", data_) || !map_file(base + ".idx", index_) ||
+      !map_file(base + ".ckp", checkpoints_) ||
+      !map_file(base + ".blk", blocks_) ||
+      !map_file(base + ".adr", addresses)) {
+    close();
+    return false;
+  }
+
+  const char* p = (const char*)addresses.address;
+  const char* end = p + addresses.size;
+  while (p < end) {
+    const char* nul = (const char*)memchr(p, '\0', end - p);
+    if (nul == NULL) break;
+    addresses_.push_back(std::string(p, nul));
+    p = nul + 1;
+  }
+  unmap_file(addresses);
+
+  num_entries_ = index_.size / sizeof(ArchiveIndexEntry);
+  num_checkpoints_ = checkpoints_.size / sizeof(ArchiveCheckpoint);
+  return true;
+}
+
+void ArchiveReader::close()
+{
+  unmap_file(data_);
+  unmap_file(index_);
+  unmap_file(checkpoints_);
+  unmap_file(blocks_);
+  num_entries_ = 0;
+  num_checkpoints_ = 0;
+  addresses_.clear();
+}
+
+size_t ArchiveReader::query(const std::string& pattern, uint64_t start,
+    uint64_t end, std::vector<ArchiveRecord>& records) const
+{
+  // match the pattern once per distinct address instead of per message
+  std::vector<char> matched(addresses_.size());
+  std::vector<uint32_t> ids; // matching address ids, ascending
+  for (size_t i = 0; i < addresses_.size(); ++i) {
+    matched[i] = Dispatcher::pattern_match(addresses_[i], pattern);
+    if (matched[i]) ids.push_back(i);
+  }
+  if (ids.empty()) return 0;
+
+  const ArchiveIndexEntry* entries = (const ArchiveIndexEntry*)index_.address;
+  const ArchiveCheckpoint* checkpoints = 
+    (const ArchiveCheckpoint*)checkpoints_.address;
+  const uint32_t* block_ids = (const uint32_t*)blocks_.address;
+  size_t num_block_ids = blocks_.size / sizeof(uint32_t);
+  const char* data = (const char*)data_.address;
+  size_t count = 0;
+  for (size_t first = 0; first < num_entries_;
+      first += kArchiveCheckpointInterval) {
+    size_t block = first / kArchiveCheckpointInterval;
+    if (block < num_checkpoints_) {
+      const ArchiveCheckpoint& checkpoint = checkpoints[block];
+      if (checkpoint.max_time < start || checkpoint.min_time > end) continue;
+      if (checkpoint.addresses > num_block_ids ||
+          checkpoint.num_addresses > num_block_ids - checkpoint.addresses) {
+        continue;
+      }
+      // skip the block unless one of its addresses matches; look up the
+      // shorter list in the longer one
+      const uint32_t* begin = block_ids + checkpoint.addresses;
+      const uint32_t* finish = begin + checkpoint.num_addresses;
+      bool found = false;
+      if (ids.size() < checkpoint.num_addresses) {
+        for (size_t j = 0; !found && j < ids.size(); ++j) {
+          found = std::binary_search(begin, finish, ids[j]);
+        }
+      } else {
+        for (const uint32_t* id = begin; !found && id != finish; ++id) {
+          found = *id < matched.size() && matched[*id];
+        }
+      }
+      if (!found) continue;
+    }
+    size_t last = std::min(first + kArchiveCheckpointInterval, num_entries_);
+    for (size_t i = first; i < last; ++i) {
+      const ArchiveIndexEntry& entry = entries[i];
+      if (entry.time < start || entry.time > end) continue;
+      if (entry.address_id >= matched.size() || !matched[entry.address_id]) {
+        continue;
+      }
+      // the data file may have been mapped before the index was complete
+      if (entry.offset + entry.size > data_.size) continue;
+      ArchiveRecord record;
+      record.time = entry.time;
+      record.address = addresses_[entry.address_id].c_str();
+      record.data = data + entry.offset;
+      record.size = entry.size;
+      records.push_back(record);
+      ++count;
+    }
+  }
+  return count;
+}
@@ -0,0 +1,93 @@
+
+#include "tnyosc-assembler.hpp"
+
+#include <arpa/inet.h>
+#include <sched.h>
+
+using namespace tnyosc;
+
+static const uint64_t kWriter = 1ULL << 32;
+static const uint64_t kWriterMask = 0x7fffffffULL << 32;
+static const uint64_t kOffsetMask = 0xffffffffULL;
+static const uint64_t kSealed = 1ULL << 63;
+static const size_t kHeaderSize = 16; // "#bundle\0" and the timetag
+// leaves room in the 32-bit offset for reservations in flight that overshoot
+static const size_t kMaxCapacity = 1 << 24;
+
+BundleAssembler::BundleAssembler(size_t capacity)
+  : current_(&buffers_[0]),
+    capacity_(capacity > kHeaderSize ? capacity - kHeaderSize : 0)
+{
+  if (capacity_ > kMaxCapacity) capacity_ = kMaxCapacity;
+  for (int i = 0; i < 2; ++i) {
+    buffers_[i].data.assign(kHeaderSize + capacity_, 0);
+    memcpy(&buffers_[i].data[0], "#bundle\0", 8);
+    buffers_[i].state = 0;
+  }
+  // the spare buffer starts sealed, as it is after every flush
+  buffers_[1].state = kSealed;
+}
+
+char* BundleAssembler::reserve(size_t size)
+{
+  uint64_t need = 4 + size;
+  if (size % 4 != 0 || need > capacity_) return NULL;
+  for (;;) {
+    Buffer* b = __atomic_load_n(&current_, __ATOMIC_ACQUIRE);
+    uint64_t old = __sync_fetch_and_add(&b->state, kWriter + need);
+    uint64_t offset = old & kOffsetMask;
+    if ((old & kSealed) || offset + need > capacity_) {
+      __sync_fetch_and_sub(&b->state, kWriter + need);
+      if (!(old & kSealed)) return NULL;
+      // the flusher has switched buffers; try the new one
+      continue;
+    }
+    char* element = &b->data[kHeaderSize + offset];
+    uint32_t n = htonl(size);
+    memcpy(element, &n, 4);
+    return element + 4;
+  }
+}
+
+void BundleAssembler::commit(char* element)
+{
+  Buffer* b = &buffers_[0];
+  if (element < &b->data[0] || element >= &b->data[0] + b->data.size()) {
+    b = &buffers_[1];
+  }
+  __sync_fetch_and_sub(&b->state, kWriter);
+}
+
+const char* BundleAssembler::flush(uint64_t timetag, size_t* size)
+{
+  Buffer* old = current_;
+  Buffer* fresh = old == &buffers_[0] ? &buffers_[1] : &buffers_[0];
+
+  // reopen the spare buffer. It is sealed, so a producer still holding it
+  // from an earlier flush backs out; wait until none is left.
+  for (;;) {
+    uint64_t state = __sync_fetch_and_add(&fresh->state, 0);
+    if ((state & kWriterMask) == 0 &&
+        __sync_bool_compare_and_swap(&fresh->state, state, 0)) {
+      break;
+    }
+    sched_yield();
+  }
+  __atomic_store_n(&current_, fresh, __ATOMIC_SEQ_CST);
+
+  uint64_t state = __sync_fetch_and_or(&old->state, kSealed);
+  while (state & kWriterMask) {
+    sched_yield();
+    state = __sync_fetch_and_add(&old->state, 0);
+  }
+
+  uint64_t length = state & kOffsetMask;
+  if (length == 0) {
+    if (size) *size = 0;
+    return NULL;
+  }
+  uint64_t t = htonll(timetag);
+  memcpy(&old->data[8], &t, 8);
+  if (size) *size = kHeaderSize + length;
+  return &old->data[0];
+}
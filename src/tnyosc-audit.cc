@@ -0,0 +1,165 @@
+
+#include "tnyosc-audit.hpp"
+
+#if TNYOSC_RT_AUDIT
+
+#include <cstring>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+using namespace tnyosc;
+
+// maximum number of distinct API names
+static const size_t kMaxScopes = 64;
+
+static AuditCounts g_counts[kMaxScopes];
+static int g_abort = 0;
+
+// outermost scope of this thread and how deeply it is nested; plain
+// thread-local PODs so that reading them never allocates
+static __thread const char* t_scope = NULL;
+static __thread int t_depth = 0;
+static __thread AuditCounts* t_counts = NULL;
+
+static AuditCounts* find_counts(const char* scope)
+{
+  for (size_t i = 0; i < kMaxScopes; ++i) {
+    const char* s = g_counts[i].scope;
+    if (s == NULL) {
+      // claim an empty slot; another thread may win it for another name
+      s = __sync_val_compare_and_swap(&g_counts[i].scope, (const char*)NULL,
+          scope);
+      if (s == NULL) return &g_counts[i];
+    }
+    if (s == scope || strcmp(s, scope) == 0) return &g_counts[i];
+  }
+  return NULL;
+}
+
+static void violation(const char* what)
+{
+  if (!g_abort) return;
+  // write(2) rather than stdio, which may allocate
+  static const char prefix[] = "tnyosc audit: ";
+  write(2, prefix, sizeof(prefix) - 1);
+  write(2, what, strlen(what));
+  write(2, " inside ", 8);
+  write(2, t_scope, strlen(t_scope));
+  write(2, "\n", 1);
+  abort();
+}
+
+AuditScope::AuditScope(const char* scope)
+{
+  if (t_depth++ > 0) return;
+  t_scope = scope;
+  t_counts = find_counts(scope);
+  if (t_counts) __sync_fetch_and_add(&t_counts->calls, 1);
+}
+
+AuditScope::~AuditScope()
+{
+  if (--t_depth > 0) return;
+  t_scope = NULL;
+  t_counts = NULL;
+}
+
+void tnyosc::audit_set_abort(bool abort_on_violation)
+{
+  g_abort = abort_on_violation ? 1 : 0;
+}
+
+size_t tnyosc::audit_report(AuditCounts* counts, size_t max)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < kMaxScopes && g_counts[i].scope != NULL; ++i, ++n) {
+    if (n < max) counts[n] = g_counts[i];
+  }
+  return n;
+}
+
+AuditCounts tnyosc::audit_counts(const char* scope)
+{
+  for (size_t i = 0; i < kMaxScopes && g_counts[i].scope != NULL; ++i) {
+    if (strcmp(g_counts[i].scope, scope) == 0) return g_counts[i];
+  }
+  AuditCounts empty;
+  memset(&empty, 0, sizeof(empty));
+  empty.scope = scope;
+  return empty;
+}
+
+void tnyosc::audit_reset()
+{
+  for (size_t i = 0; i < kMaxScopes; ++i) {
+    g_counts[i].calls = 0;
+    g_counts[i].allocations = 0;
+    g_counts[i].frees = 0;
+    g_counts[i].locks = 0;
+  }
+}
+
+#if defined(__GLIBC__)
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size)
+{
+  if (t_counts) {
+    __sync_fetch_and_add(&t_counts->allocations, 1);
+    violation("malloc");
+  }
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+  if (t_counts) {
+    __sync_fetch_and_add(&t_counts->allocations, 1);
+    violation("calloc");
+  }
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+  if (t_counts) {
+    __sync_fetch_and_add(&t_counts->allocations, 1);
+    violation("realloc");
+  }
+  return __libc_realloc(p, size);
+}
+
+void free(void* p)
+{
+  if (t_counts && p != NULL) {
+    __sync_fetch_and_add(&t_counts->frees, 1);
+    violation("free");
+  }
+  __libc_free(p);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+  typedef int (*lock_function)(pthread_mutex_t*);
+  static lock_function next_lock = NULL;
+  if (next_lock == NULL) {
+    next_lock = (lock_function)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+  }
+  if (t_counts) {
+    __sync_fetch_and_add(&t_counts->locks, 1);
+    violation("pthread_mutex_lock");
+  }
+  return next_lock(mutex);
+}
+
+} // extern "C"
+#endif // __GLIBC__
+
+#endif // TNYOSC_RT_AUDIT
@@ -0,0 +1,114 @@
+
+#include "tnyosc-block.hpp"
+#include "tnyosc-audit.hpp"
+
+#include <algorithm>
+
+using namespace tnyosc;
+
+bool BlockScheduler::Ring::push(CallbackRef* callback)
+{
+  size_t t = tail;
+  size_t next = (t + 1) % slots.size();
+  if (next == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) return false;
+  slots[t] = callback;
+  __atomic_store_n(&tail, next, __ATOMIC_RELEASE);
+  return true;
+}
+
+CallbackRef* BlockScheduler::Ring::pop()
+{
+  size_t h = head;
+  if (h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) return NULL;
+  CallbackRef* callback = slots[h];
+  __atomic_store_n(&head, (h + 1) % slots.size(), __ATOMIC_RELEASE);
+  return callback;
+}
+
+BlockScheduler::BlockScheduler(size_t capacity, size_t max_block_events)
+  : capacity_(capacity > 0 ? capacity : 1), outstanding_(0), pending_(NULL),
+    heap_size_(0), seq_(0), num_in_use_(0)
+{
+  // one spare slot tells a full ring from an empty one
+  incoming_.slots.resize(capacity_ + 1);
+  incoming_.head = incoming_.tail = 0;
+  retired_.slots.resize(capacity_ + 1);
+  retired_.head = retired_.tail = 0;
+  heap_.resize(capacity_);
+  in_use_.resize(max_block_events > 0 ? max_block_events : 1);
+}
+
+BlockScheduler::~BlockScheduler()
+{
+  CallbackRef* callback;
+  while ((callback = incoming_.pop()) != NULL) delete callback;
+  while ((callback = retired_.pop()) != NULL) delete callback;
+  delete pending_;
+  for (size_t i = 0; i < heap_size_; ++i) delete heap_[i].callback;
+  for (size_t i = 0; i < num_in_use_; ++i) delete in_use_[i];
+}
+
+void BlockScheduler::collect()
+{
+  CallbackRef* callback;
+  while ((callback = retired_.pop()) != NULL) {
+    delete callback;
+    --outstanding_;
+  }
+}
+
+bool BlockScheduler::post(const CallbackRef& callback)
+{
+  collect();
+  // the rings and the heap each hold capacity_ callbacks, so bounding the
+  // outstanding ones keeps every push on the audio thread from failing
+  if (outstanding_ >= capacity_) return false;
+  CallbackRef* ref = new CallbackRef(callback);
+  if (!incoming_.push(ref)) {
+    delete ref;
+    return false;
+  }
+  ++outstanding_;
+  return true;
+}
+
+size_t BlockScheduler::process(uint64_t block_start, double sample_rate,
+    uint32_t frames, BlockEvent* out, size_t max)
+{
+  TNYOSC_AUDIT_SCOPE("BlockScheduler::process");
+  // the events of the previous block are done with
+  for (size_t i = 0; i < num_in_use_; ++i) retired_.push(in_use_[i]);
+  num_in_use_ = 0;
+
+  // move newly posted callbacks into the heap
+  for (;;) {
+    if (pending_ == NULL) pending_ = incoming_.pop();
+    if (pending_ == NULL || heap_size_ == heap_.size()) break;
+    Event& e = heap_[heap_size_++];
+    e.time = unixtime_to_ntp((*pending_)->timetag);
+    e.seq = seq_++;
+    e.callback = pending_;
+    std::push_heap(heap_.begin(), heap_.begin() + heap_size_, LaterEvent());
+    pending_ = NULL;
+  }
+
+  // NTP units per frame, in 32.32 fixed point
+  double ntp_per_frame = 4294967296.0 / sample_rate;
+  uint64_t block_end = block_start + (uint64_t)(frames * ntp_per_frame);
+  max = std::min(max, in_use_.size());
+  size_t count = 0;
+  while (count < max && heap_size_ > 0 && heap_[0].time < block_end) {
+    std::pop_heap(heap_.begin(), heap_.begin() + heap_size_, LaterEvent());
+    const Event& e = heap_[--heap_size_];
+    uint32_t offset = 0;
+    if (e.time > block_start) {
+      offset = (uint32_t)((e.time - block_start) / ntp_per_frame);
+      if (offset >= frames) offset = frames - 1;
+    }
+    out[count].offset = offset;
+    out[count].callback = e.callback->get();
+    in_use_[num_in_use_++] = e.callback;
+    ++count;
+  }
+  return count;
+}
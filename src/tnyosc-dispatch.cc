@@ -1,4 +1,6 @@
 #include "tnyosc-dispatch.hpp"
+#include "tnyosc-audit.hpp"
+#include "tnyosc-pool.hpp"
 #include "tnyosc.hpp"
 
 #include <algorithm>
@@ -7,6 +9,9 @@
 #include <assert.h>
 #include <arpa/inet.h>
 #include <stdio.h>
+#if TNYOSC_STATS
+#include <time.h> // clock_gettime
+#endif // TNYOSC_STATS
 
 using namespace tnyosc;
 
@@ -43,64 +48,488 @@ Argument::Argument()
   memset(&data, 0, sizeof(data));
 }
 
-Argument::Argument(const Argument& a) 
+ArrayView::ArrayView()
+  : type(0), count(0), data(NULL)
 {
-  type = a.type;
-  size = a.size;
-  switch(type) {
-    case 's':
-    case 'S':
-      data.s = strndup(a.data.s, a.size);
-      break;
-    case'b':
-      data.b = malloc(sizeof(size));
-      memcpy(data.b, a.data.b, size);
-      break;
-    default:
-      data = a.data;
-      break;
+}
+
+bool ArrayView::assign(const std::vector<Argument>& argv, size_t index)
+{
+  type = 0;
+  count = 0;
+  data = NULL;
+  if (index >= argv.size() || argv[index].type != '[') return false;
+
+  char elem = 0;
+  size_t n = 0;
+  size_t i = index + 1;
+  for (; i < argv.size() && argv[i].type != ']'; ++i, ++n) {
+    if (elem == 0) elem = argv[i].type;
+    if (argv[i].type != elem) return false;
+  }
+  if (i == argv.size()) return false;
+  if (n > 0 && elem != 'i' && elem != 'f' && elem != 'h' && elem != 'd') {
+    return false;
   }
+
+  type = elem;
+  count = n;
+  data = (const char*)argv[index].data.b;
+  return true;
 }
 
-Argument::~Argument() 
+size_t ArrayView::copy_to(int32_t* out, size_t max) const
 {
-  switch(type) {
-    case 's':
-    case 'S':
-    case'b':
-      free(data.s);
+  TNYOSC_AUDIT_SCOPE("ArrayView::copy_to");
+  if (type != 'i') return 0;
+  size_t n = std::min(count, max);
+  swap_copy32(out, data, n);
+  return n;
+}
+
+size_t ArrayView::copy_to(float* out, size_t max) const
+{
+  TNYOSC_AUDIT_SCOPE("ArrayView::copy_to");
+  if (type != 'f') return 0;
+  size_t n = std::min(count, max);
+  swap_copy32(out, data, n);
+  return n;
+}
+
+size_t ArrayView::copy_to(int64_t* out, size_t max) const
+{
+  TNYOSC_AUDIT_SCOPE("ArrayView::copy_to");
+  if (type != 'h') return 0;
+  size_t n = std::min(count, max);
+  swap_copy64(out, data, n);
+  return n;
+}
+
+size_t ArrayView::copy_to(double* out, size_t max) const
+{
+  TNYOSC_AUDIT_SCOPE("ArrayView::copy_to");
+  if (type != 'd') return 0;
+  size_t n = std::min(count, max);
+  swap_copy64(out, data, n);
+  return n;
+}
+
+MessageReader::MessageReader()
+  : end_(NULL), address_(NULL), types_(NULL), args_(NULL), num_args_(0),
+    cursor_index_(0), cursor_(NULL)
+{
+}
+
+// returns the size of an OSC-string including its padding, or 0 if the
+// string is not terminated before end
+static size_t padded_string_size(const char* s, const char* end)
+{
+  const char* nul = (const char*)memchr(s, '\0', end - s);
+  if (nul == NULL) return 0;
+  size_t len = nul - s;
+  return len + (4 - len % 4);
+}
+
+bool MessageReader::parse(const char* data, size_t size)
+{
+  TNYOSC_AUDIT_SCOPE("MessageReader::parse");
+  const char* end = data + size;
+  size_t addr_size = padded_string_size(data, end);
+  if (addr_size == 0 || addr_size > size || data[0] == '#') return false;
+  const char* types = data + addr_size;
+  if (types == end || *types != ',') return false;
+  size_t types_size = padded_string_size(types, end);
+  if (types_size == 0 || types_size > (size_t)(end - types)) return false;
+
+  end_ = end;
+  address_ = data;
+  types_ = types + 1;
+  args_ = types + types_size;
+  num_args_ = strlen(types_);
+  cursor_index_ = 0;
+  cursor_ = args_;
+  return true;
+}
+
+size_t MessageReader::run_length(size_t index) const
+{
+  if (index >= num_args_) return 0;
+  size_t i = index + 1;
+  while (i < num_args_ && types_[i] == types_[index]) ++i;
+  return i - index;
+}
+
+bool MessageReader::seek(size_t index)
+{
+  if (index >= num_args_) return false;
+  if (index < cursor_index_) {
+    cursor_index_ = 0;
+    cursor_ = args_;
   }
+  while (cursor_index_ < index) {
+    size_t remain = end_ - cursor_;
+    size_t arg_size = 0;
+    switch (types_[cursor_index_]) {
+      case 'i': case 'f': case 'r': case 'c': case 'm':
+        arg_size = 4;
+        break;
+      case 'h': case 'd': case 't':
+        arg_size = 8;
+        break;
+      case 's': case 'S':
+        arg_size = padded_string_size(cursor_, end_);
+        if (arg_size == 0) return false;
+        break;
+      case 'b':
+        {
+          if (remain < 4) return false;
+          uint32_t blob_size;
+          memcpy(&blob_size, cursor_, 4);
+          blob_size = ntohl(blob_size);
+          arg_size = 4 + blob_size;
+          if (blob_size % 4 != 0) arg_size += 4 - blob_size % 4;
+        }
+        break;
+    }
+    if (arg_size > remain) return false;
+    cursor_ += arg_size;
+    ++cursor_index_;
+  }
+  return true;
+}
+
+size_t MessageReader::read_run(size_t index, char type, size_t width,
+    void* out, size_t max)
+{
+  TNYOSC_AUDIT_SCOPE("MessageReader::read");
+  if (index >= num_args_ || types_[index] != type) return 0;
+  if (!seek(index)) return 0;
+  size_t n = std::min(run_length(index), max);
+  if (n * width > (size_t)(end_ - cursor_)) return 0;
+  if (width == 4) {
+    swap_copy32(out, cursor_, n);
+  } else {
+    swap_copy64(out, cursor_, n);
+  }
+  cursor_ += n * width;
+  cursor_index_ += n;
+  return n;
+}
+
+size_t MessageReader::read_int32s(size_t index, int32_t* out, size_t max)
+{
+  return read_run(index, 'i', 4, out, max);
+}
+
+size_t MessageReader::read_floats(size_t index, float* out, size_t max)
+{
+  return read_run(index, 'f', 4, out, max);
 }
 
-Argument& Argument::operator=(const Argument& a) 
+size_t MessageReader::read_int64s(size_t index, int64_t* out, size_t max)
+{
+  return read_run(index, 'h', 8, out, max);
+}
+
+size_t MessageReader::read_doubles(size_t index, double* out, size_t max)
+{
+  return read_run(index, 'd', 8, out, max);
+}
+
+#if TNYOSC_STATS
+static uint64_t monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+LatencyHistogram::LatencyHistogram()
+  : count(0), total_ns(0), max_ns(0)
+{
+  memset(buckets, 0, sizeof(buckets));
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+  ++count;
+  total_ns += ns;
+  if (ns > max_ns) max_ns = ns;
+
+  // values below kSubBuckets get a bucket each; above that, the top kSubBits
+  // bits below the leading one select the sub-bucket of its power of two
+  int index;
+  if (ns < (uint64_t)kSubBuckets) {
+    index = (int)ns;
+  } else {
+    int bits = 63 - __builtin_clzll(ns);
+    if (bits >= kMaxBits) {
+      index = kNumBuckets - 1;
+    } else {
+      int sub = (int)(ns >> (bits - kSubBits)) & (kSubBuckets - 1);
+      index = (bits - kSubBits + 1) * kSubBuckets + sub;
+    }
+  }
+  ++buckets[index];
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+  count += other.count;
+  total_ns += other.total_ns;
+  if (other.max_ns > max_ns) max_ns = other.max_ns;
+  for (int i = 0; i < kNumBuckets; ++i) buckets[i] += other.buckets[i];
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+  if (count == 0) return 0;
+  uint64_t rank = (uint64_t)(count * p / 100.0);
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      if (i < kSubBuckets) return i;
+      int bits = i / kSubBuckets + kSubBits - 1;
+      uint64_t sub = i % kSubBuckets;
+      return (1ULL << bits) | (sub << (bits - kSubBits));
+    }
+  }
+  return max_ns;
+}
+
+DispatchStats::DispatchStats()
+  : packets(0), messages(0), callbacks(0)
+{
+  memset(decode_errors, 0, sizeof(decode_errors));
+}
+
+void DispatchStats::merge(const DispatchStats& other)
+{
+  packets += other.packets;
+  messages += other.messages;
+  callbacks += other.callbacks;
+  for (int i = 0; i < kNumDecodeErrors; ++i) {
+    decode_errors[i] += other.decode_errors[i];
+  }
+  decode_latency.merge(other.decode_latency);
+  match_latency.merge(other.match_latency);
+  handler_latency.merge(other.handler_latency);
+  // replicas share the same registration order, so counters line up by index
+  if (methods.size() < other.methods.size()) {
+    size_t i = methods.size();
+    methods.resize(other.methods.size());
+    for (; i < methods.size(); ++i) {
+      methods[i].address = other.methods[i].address;
+      methods[i].match_attempts = 0;
+      methods[i].match_hits = 0;
+    }
+  }
+  for (size_t i = 0; i < other.methods.size(); ++i) {
+    methods[i].match_attempts += other.methods[i].match_attempts;
+    methods[i].match_hits += other.methods[i].match_hits;
+  }
+}
+#endif // TNYOSC_STATS
+
+MatchCache::MatchCache(size_t capacity)
+  : capacity_(capacity), hand_(0), generation_(0)
+{
+}
+
+void MatchCache::set_capacity(size_t capacity)
+{
+  capacity_ = capacity;
+  clear();
+}
+
+void MatchCache::clear()
+{
+  entries_.clear();
+  index_.clear();
+  hand_ = 0;
+}
+
+const std::vector<uint32_t>* MatchCache::find(const std::string& address,
+    uint64_t generation)
+{
+  if (generation != generation_) {
+    // methods were added since these entries were filled in
+    clear();
+    generation_ = generation;
+  }
+  Index::iterator it = index_.find(address);
+  if (it == index_.end()) {
+    ++stats_.misses;
+    return NULL;
+  }
+  ++stats_.hits;
+  Entry& entry = entries_[it->second];
+  entry.referenced = true;
+  return &entry.methods;
+}
+
+const std::vector<uint32_t>* MatchCache::insert(const std::string& address,
+    uint64_t generation, const std::vector<uint32_t>& methods)
+{
+  if (capacity_ == 0 || generation != generation_) {
+    scratch_ = methods;
+    return &scratch_;
+  }
+
+  size_t slot;
+  if (entries_.size() < capacity_) {
+    slot = entries_.size();
+    entries_.push_back(Entry());
+  } else {
+    // CLOCK: skip over recently used entries, clearing their reference bit
+    while (entries_[hand_].referenced) {
+      entries_[hand_].referenced = false;
+      hand_ = (hand_ + 1) % entries_.size();
+    }
+    slot = hand_;
+    hand_ = (hand_ + 1) % entries_.size();
+    index_.erase(entries_[slot].address);
+    ++stats_.evictions;
+  }
+
+  Entry& entry = entries_[slot];
+  entry.address = address;
+  entry.methods = methods;
+  entry.referenced = false;
+  index_[address] = slot;
+  return &entry.methods;
+}
+
+static void decode_int32(const char* data, Argument& argument)
+{
+  uint32_t int32;
+  memcpy(&int32, data, 4);
+  int32 = ntohl(int32);
+  memcpy(&argument.data.i, &int32, 4);
+  argument.size = 4;
+}
+
+static void decode_int64(const char* data, Argument& argument)
+{
+  uint64_t int64;
+  memcpy(&int64, data, 8);
+  int64 = ntohll(int64);
+  memcpy(&argument.data.h, &int64, 8);
+  argument.size = 8;
+}
+
+static void decode_char(const char* data, Argument& argument)
+{
+  uint32_t int32;
+  memcpy(&int32, data, 4);
+  argument.data.c = (char)ntohl(int32);
+  argument.size = 1;
+}
+
+static void decode_midi(const char* data, Argument& argument)
+{
+  memcpy(&argument.data.m, data, 4);
+  argument.size = 4;
+}
+
+static void decode_none(const char*, Argument&)
+{
+}
+
+// Sets the data size and decoder of a fixed-size type tag. Returns false for
+// variable-length types ('s', 'S', 'b') and arrays.
+static bool fixed_argument(char type, size_t* size,
+    SignatureLayout::decode_function* decode)
 {
-  if (this == &a) return *this;
   switch (type) {
+    case 'i':
+    case 'f':
+    case 'r':
+      *size = 4; *decode = &decode_int32;
+      return true;
+    case 'h':
+    case 'd':
+    case 't':
+      *size = 8; *decode = &decode_int64;
+      return true;
+    case 'c':
+      *size = 4; *decode = &decode_char;
+      return true;
+    case 'm':
+      *size = 4; *decode = &decode_midi;
+      return true;
     case 's':
     case 'S':
     case 'b':
-      free(data.s);
+    case '[':
+    case ']':
+      return false;
+    default:
+      // T, F, N, I and unknown tags carry no data
+      *size = 0; *decode = &decode_none;
+      return true;
   }
+}
 
-  type = a.type;
-  size = a.size;
-  switch(type) {
-    case 's':
-    case 'S':
-      data.s = strndup(a.data.s, a.size);
-      break;
-    case'b':
-      data.b = malloc(sizeof(size));
-      memcpy(data.b, a.data.b, size);
-      break;
-    default:
-      data = a.data;
+SignatureCache::SignatureCache(size_t capacity)
+  : capacity_(capacity == 0 ? 1 : capacity), size_(0)
+{
+  size_t slots = 4;
+  while (slots < capacity_ * 2) slots *= 2;
+  entries_.resize(slots);
+  clear();
+}
+
+void SignatureCache::clear()
+{
+  for (size_t i = 0; i < entries_.size(); ++i) entries_[i].used = false;
+  size_ = 0;
+}
+
+const SignatureLayout& SignatureCache::find(const char* types, size_t size)
+{
+  // FNV-1a; type tag strings are short
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ (unsigned char)types[i]) * 16777619u;
   }
-  return *this;
+  size_t mask = entries_.size() - 1;
+  size_t i = hash & mask;
+  for (; entries_[i].used; i = (i + 1) & mask) {
+    const Entry& entry = entries_[i];
+    if (entry.hash == hash && entry.types.size() == size &&
+        memcmp(entry.types.data(), types, size) == 0) {
+      return entry.layout;
+    }
+  }
+
+  if (size_ >= capacity_) {
+    clear();
+    i = hash & mask;
+  }
+  Entry& entry = entries_[i];
+  entry.used = true;
+  entry.hash = hash;
+  entry.types.assign(types, size);
+  ++size_;
+  SignatureLayout& layout = entry.layout;
+  layout.slots.clear();
+  layout.fixed_size = 0;
+  SignatureLayout::Slot slot;
+  size_t arg_size;
+  for (size_t j = 0; j < size; ++j) {
+    if (!fixed_argument(types[j], &arg_size, &slot.decode)) break;
+    slot.offset = layout.fixed_size;
+    layout.slots.push_back(slot);
+    layout.fixed_size += arg_size;
+  }
+  return layout;
 }
 
 Dispatcher::Dispatcher() 
-  : methods_(0)
+  : cache_(kDefaultCacheCapacity), generation_(0)
 {
 }
 
@@ -111,56 +540,474 @@ Dispatcher::~Dispatcher()
 void Dispatcher::add_method(const char* address, const char* types, 
     osc_method method, void* user_data) 
 {
-  MethodTemplate m;
-  m.address = address == NULL ? "" : address;
-  m.types = types == NULL ? "" : types;
-  m.user_data = user_data;
-  m.method = method;
-  methods_.push_back(m);
+  index_.add(address == NULL ? "" : address, types == NULL ? "" : types);
+  MethodBinding binding;
+  binding.method = method;
+  binding.user_data = user_data;
+  bindings_.push_back(binding);
+  ++generation_;
+#if TNYOSC_STATS
+  // the lookup count left in the old last slot becomes the new method's base
+  method_counts_.resize(bindings_.size() * 2 + 1, 0);
+  method_counts_.back() = method_counts_[method_counts_.size() - 3];
+#endif // TNYOSC_STATS
+}
+
+bool Dispatcher::save_snapshot(const char* path) const
+{
+  return index_.save(path);
+}
+
+bool Dispatcher::load_snapshot(const char* path, const osc_method* methods,
+    void* const* user_data, size_t num_methods)
+{
+  MethodIndex index;
+  if (!index.load(path) || index.size() != num_methods) return false;
+  index_ = index;
+  bindings_.resize(num_methods);
+  for (size_t i = 0; i < num_methods; ++i) {
+    bindings_[i].method = methods[i];
+    bindings_[i].user_data = user_data == NULL ? NULL : user_data[i];
+  }
+  ++generation_;
+#if TNYOSC_STATS
+  method_counts_.assign(num_methods * 2 + 1, 0);
+#endif // TNYOSC_STATS
+  return true;
+}
+
+void Dispatcher::set_cache_capacity(size_t capacity)
+{
+  cache_.set_capacity(capacity);
 }
 
 std::list<CallbackRef> Dispatcher::match_methods(const char* data, size_t size)
 {
+  TNYOSC_AUDIT_SCOPE("Dispatcher::match_methods");
   std::list<ParsedMessage> parsed_messages;
   std::list<CallbackRef> callback_list;
-  if (!decode_data(data, size, parsed_messages)) return callback_list;
+  // the callbacks outlive data, so their arguments point into one copy
+  PacketBuffer buffer(new std::vector<char>(data, data + size));
+  if (size > 0) data = &(*buffer)[0];
+#if TNYOSC_STATS
+  ++stats_.packets;
+  uint64_t start_ns = monotonic_ns();
+  DecodeError error = kDecodeOk;
+  if (!decode_data(data, size, parsed_messages, kZeroTimetag, &error,
+        &signatures_)) {
+    ++stats_.decode_errors[error];
+    return callback_list;
+  }
+  uint64_t decoded_ns = monotonic_ns();
+  stats_.decode_latency.record(decoded_ns - start_ns);
+  stats_.messages += parsed_messages.size();
+#else
+  if (!decode_data(data, size, parsed_messages, kZeroTimetag, NULL,
+        &signatures_)) {
+    return callback_list;
+  }
+#endif // TNYOSC_STATS
 #if TNYOSC_DEBUG
   std::cerr << __FUNCTION__ << ": decode success" << std::endl;
 #endif // TNYOSC_DEBUG
   assert(parsed_messages.size() > 0);
 
   // iterate through all the messages and find matches with registered methods
+  uint64_t* counts = NULL;
+#if TNYOSC_STATS
+  if (!method_counts_.empty()) counts = &method_counts_[0];
+#endif // TNYOSC_STATS
+  std::vector<uint32_t> indices;
   std::list<ParsedMessage>::iterator msg_iter = parsed_messages.begin();
   for (; msg_iter != parsed_messages.end(); ++msg_iter) {
+    msg_iter->buffer = buffer;
+    const std::vector<uint32_t>* cached = 
+      cache_.find(msg_iter->address, generation_);
+    if (cached == NULL) {
+      indices.clear();
+      find_methods(msg_iter->address, indices, counts);
+      cached = cache_.insert(msg_iter->address, generation_, indices);
+    }
+    add_callbacks(*msg_iter, *cached, callback_list, counts);
+  }
+
+  callback_list.sort(compare_callback_timetag);
+
+#if TNYOSC_STATS
+  stats_.callbacks += callback_list.size();
+  stats_.match_latency.record(monotonic_ns() - decoded_ns);
+#endif // TNYOSC_STATS
+  return callback_list;
+}
+
+void Dispatcher::find_methods(const std::string& address,
+    std::vector<uint32_t>& indices, uint64_t* counts) const
+{
 #if TNYOSC_DEBUG
-    std::cerr << __FUNCTION__ << ": matching " << msg_iter->address << "\n";
+  std::cerr << __FUNCTION__ << ": matching " << address << "\n";
 #endif // TNYOSC_DEBUG
-    std::list<MethodTemplate>::const_iterator method_iter = methods_.begin();
-    for (; method_iter != methods_.end(); ++method_iter) {
-      if (pattern_match(msg_iter->address, method_iter->address)) {
+#if TNYOSC_STATS
+  if (counts != NULL) ++counts[bindings_.size() * 2];
+#else
+  (void)counts;
+#endif // TNYOSC_STATS
+  index_.find(address, indices);
 #if TNYOSC_DEBUG
-        std::cerr << "   matched " << method_iter->address << "\n";
+  for (size_t i = 0; i < indices.size(); ++i) {
+    std::cerr << "   matched " << index_.address(indices[i]) << "\n";
+  }
 #endif // TNYOSC_DEBUG
-        // if a method specifies a type, make sure it matches
-        if (method_iter->types.empty() ||
-            !msg_iter->types.compare(method_iter->types)) {
-          CallbackRef callback = CallbackRef(new Callback());
-          callback->timetag = msg_iter->timetag;
-          callback->address = msg_iter->address;
-          callback->argv = msg_iter->argv;
-          callback->user_data = method_iter->user_data;
-          callback->method = method_iter->method;
-          callback_list.push_back(callback);
-        }
-      }
+}
+
+void Dispatcher::add_callbacks(const ParsedMessage& message,
+    const std::vector<uint32_t>& indices, std::list<CallbackRef>& callbacks,
+    uint64_t* counts) const
+{
+#if !TNYOSC_STATS
+  (void)counts;
+#endif // !TNYOSC_STATS
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const MethodBinding& method = bindings_[indices[i]];
+    // if a method specifies a type, make sure it matches
+    if (index_.accepts(indices[i], message.types)) {
+      CallbackRef callback = CallbackRef(new Callback());
+      callback->timetag = message.timetag;
+      callback->address = message.address;
+      callback->argv = message.argv;
+      callback->user_data = method.user_data;
+      callback->method = method.method;
+      callback->buffer = message.buffer;
+      callbacks.push_back(callback);
+#if TNYOSC_STATS
+      ++counts[indices[i] * 2 + 1];
+#endif // TNYOSC_STATS
+    }
+  }
+}
+
+void Dispatcher::match_message(const ParsedMessage& message,
+    std::list<CallbackRef>& callbacks, uint64_t* counts) const
+{
+  std::vector<uint32_t> indices;
+  find_methods(message.address, indices, counts);
+  add_callbacks(message, indices, callbacks, counts);
+}
+
+// state shared by the match_range tasks of one match_methods_parallel call
+struct ParallelMatch {
+  const Dispatcher* dispatcher;
+  PacketBuffer buffer; // copy of the packet the elements point into
+  const std::vector<PacketElement>* elements;
+  size_t range_size;
+  std::vector<std::list<CallbackRef> > callbacks; // one list per range
+  std::vector<char> failed; // one flag per range
+#if TNYOSC_STATS
+  std::vector<std::vector<uint64_t> > counts; // method counts per range
+#endif // TNYOSC_STATS
+};
+
+void Dispatcher::match_range(void* arg, size_t index)
+{
+  ParallelMatch* match = (ParallelMatch*)arg;
+  const std::vector<PacketElement>& elements = *match->elements;
+  size_t begin = index * match->range_size;
+  size_t end = std::min(begin + match->range_size, elements.size());
+  uint64_t* counts = NULL;
+#if TNYOSC_STATS
+  if (!match->counts[index].empty()) counts = &match->counts[index][0];
+#endif // TNYOSC_STATS
+
+  std::list<ParsedMessage> messages;
+  for (size_t i = begin; i < end; ++i) {
+    if (!decode_osc(elements[i].data, elements[i].size, messages,
+          elements[i].timetag, NULL, NULL)) {
+      match->failed[index] = 1;
+      return;
     }
+    messages.back().buffer = match->buffer;
+    match->dispatcher->match_message(messages.back(),
+        match->callbacks[index], counts);
+  }
+}
+
+std::list<CallbackRef> Dispatcher::match_methods_parallel(const char* data,
+    size_t size, WorkerPool& pool)
+{
+  TNYOSC_AUDIT_SCOPE("Dispatcher::match_methods_parallel");
+  std::list<CallbackRef> callback_list;
+  std::vector<PacketElement> elements;
+  PacketBuffer buffer(new std::vector<char>(data, data + size));
+  if (size > 0) data = &(*buffer)[0];
+#if TNYOSC_STATS
+  ++stats_.packets;
+  uint64_t start_ns = monotonic_ns();
+  DecodeError error = kDecodeOk;
+  if (!index_packet(data, size, elements, kZeroTimetag, &error)) {
+    ++stats_.decode_errors[error];
+    return callback_list;
   }
+  uint64_t indexed_ns = monotonic_ns();
+  // messages are decoded while matching, so only indexing is counted here
+  stats_.decode_latency.record(indexed_ns - start_ns);
+#else
+  if (!index_packet(data, size, elements)) return callback_list;
+#endif // TNYOSC_STATS
+  // an empty bundle is valid but has nothing to match
+  if (elements.empty()) return callback_list;
+
+  // a few ranges per thread so that uneven messages still balance out
+  size_t num_ranges = std::min(elements.size(), (pool.size() + 1) * 4);
+  ParallelMatch match;
+  match.dispatcher = this;
+  match.buffer = buffer;
+  match.elements = &elements;
+  match.range_size = (elements.size() + num_ranges - 1) / num_ranges;
+  num_ranges = (elements.size() + match.range_size - 1) / match.range_size;
+  match.callbacks.resize(num_ranges);
+  match.failed.resize(num_ranges, 0);
+#if TNYOSC_STATS
+  match.counts.resize(num_ranges, std::vector<uint64_t>(method_counts_.size()));
+#endif // TNYOSC_STATS
 
+  pool.run(&Dispatcher::match_range, &match, num_ranges);
+
+  for (size_t i = 0; i < num_ranges; ++i) {
+    if (match.failed[i]) {
+#if TNYOSC_STATS
+      ++stats_.decode_errors[kDecodeBadArgument];
+#endif // TNYOSC_STATS
+      return std::list<CallbackRef>();
+    }
+    callback_list.splice(callback_list.end(), match.callbacks[i]);
+  }
   callback_list.sort(compare_callback_timetag);
 
+#if TNYOSC_STATS
+  stats_.messages += elements.size();
+  stats_.callbacks += callback_list.size();
+  for (size_t i = 0; i < num_ranges; ++i) {
+    for (size_t j = 0; j < method_counts_.size(); ++j) {
+      method_counts_[j] += match.counts[i][j];
+    }
+  }
+  stats_.match_latency.record(monotonic_ns() - indexed_ns);
+#endif // TNYOSC_STATS
   return callback_list;
 }
 
+void Dispatcher::invoke(const CallbackRef& callback)
+{
+#if TNYOSC_STATS
+  uint64_t start_ns = monotonic_ns();
+  callback->method(callback->address, callback->argv, callback->user_data);
+  stats_.handler_latency.record(monotonic_ns() - start_ns);
+#else
+  callback->method(callback->address, callback->argv, callback->user_data);
+#endif // TNYOSC_STATS
+}
+
+// Sorts matches by timetag with a stable LSD radix sort, one byte per pass.
+// Bytes that are the same in every key are skipped, so a batch of immediate
+// messages costs a single scan.
+static void radix_sort(std::vector<BatchMatch>& matches,
+    std::vector<BatchMatch>& scratch)
+{
+  size_t n = matches.size();
+  if (n < 2) return;
+  uint64_t differ = 0;
+  for (size_t i = 1; i < n; ++i) {
+    differ |= matches[i].timetag ^ matches[0].timetag;
+  }
+  if (differ == 0) return;
+
+  scratch.resize(n);
+  BatchMatch* src = &matches[0];
+  BatchMatch* dst = &scratch[0];
+  for (int shift = 0; shift < 64; shift += 8) {
+    if (((differ >> shift) & 0xff) == 0) continue;
+    size_t offsets[256] = {0};
+    for (size_t i = 0; i < n; ++i) ++offsets[(src[i].timetag >> shift) & 0xff];
+    size_t total = 0;
+    for (int b = 0; b < 256; ++b) {
+      size_t count = offsets[b];
+      offsets[b] = total;
+      total += count;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      dst[offsets[(src[i].timetag >> shift) & 0xff]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+  if (src != &matches[0]) std::copy(src, src + n, matches.begin());
+}
+
+void Dispatcher::match_batch(const PacketRef* packets, size_t n,
+    MatchBatch& out)
+{
+  TNYOSC_AUDIT_SCOPE("Dispatcher::match_batch");
+  out.num_messages = 0;
+  out.matches.clear();
+  out.malformed = 0;
+  out.groups_.clear();
+  uint64_t* counts = NULL;
+#if TNYOSC_STATS
+  stats_.packets += n;
+  uint64_t start_ns = monotonic_ns();
+  if (!method_counts_.empty()) counts = &method_counts_[0];
+#endif // TNYOSC_STATS
+
+  // decode every packet into the reusable message slots
+  for (size_t p = 0; p < n; ++p) {
+    size_t first = out.num_messages;
+    DecodeError error = kDecodeOk;
+    out.elements_.clear();
+    bool ok = index_packet(packets[p].data, packets[p].size, out.elements_,
+        kZeroTimetag, &error);
+    for (size_t i = 0; ok && i < out.elements_.size(); ++i) {
+      if (out.num_messages == out.messages.size()) {
+        out.messages.push_back(ParsedMessage());
+      }
+      const PacketElement& e = out.elements_[i];
+      ok = decode_message(e.data, e.size, out.messages[out.num_messages],
+          e.timetag, &error, &signatures_);
+      if (ok) ++out.num_messages;
+    }
+    if (!ok) {
+      out.num_messages = first;
+      ++out.malformed;
+#if TNYOSC_STATS
+      ++stats_.decode_errors[error];
+#endif // TNYOSC_STATS
+    }
+  }
+#if TNYOSC_STATS
+  uint64_t decoded_ns = monotonic_ns();
+  stats_.decode_latency.record(decoded_ns - start_ns);
+  stats_.messages += out.num_messages;
+#endif // TNYOSC_STATS
+
+  // match each distinct address once, then pair every message with the
+  // methods of its address whose types fit
+  size_t num_groups = 0;
+  for (size_t i = 0; i < out.num_messages; ++i) {
+    const ParsedMessage& m = out.messages[i];
+    std::pair<std::tr1::unordered_map<std::string, uint32_t>::iterator, bool>
+      group = out.groups_.insert(std::make_pair(m.address, num_groups));
+    if (group.second) {
+      if (num_groups == out.group_methods_.size()) {
+        out.group_methods_.push_back(std::vector<uint32_t>());
+      }
+      std::vector<uint32_t>& indices = out.group_methods_[num_groups++];
+      const std::vector<uint32_t>* cached = cache_.find(m.address, generation_);
+      if (cached == NULL) {
+        indices.clear();
+        find_methods(m.address, indices, counts);
+        cache_.insert(m.address, generation_, indices);
+      } else {
+        indices = *cached;
+      }
+    }
+
+    const std::vector<uint32_t>& indices =
+      out.group_methods_[group.first->second];
+    BatchMatch match;
+    match.timetag = m.timetag.tv_sec < 0 ? 0 :
+      (uint64_t)m.timetag.tv_sec * 1000000 + m.timetag.tv_usec;
+    match.message = i;
+    for (size_t j = 0; j < indices.size(); ++j) {
+      if (index_.accepts(indices[j], m.types)) {
+        match.method = indices[j];
+        out.matches.push_back(match);
+#if TNYOSC_STATS
+        ++counts[indices[j] * 2 + 1];
+#endif // TNYOSC_STATS
+      }
+    }
+  }
+  radix_sort(out.matches, out.scratch_);
+
+#if TNYOSC_STATS
+  stats_.callbacks += out.matches.size();
+  stats_.match_latency.record(monotonic_ns() - decoded_ns);
+#endif // TNYOSC_STATS
+}
+
+void Dispatcher::invoke(const MatchBatch& batch, const BatchMatch& match)
+{
+  const ParsedMessage& m = batch.messages[match.message];
+  const MethodBinding& method = bindings_[match.method];
+#if TNYOSC_STATS
+  uint64_t start_ns = monotonic_ns();
+  method.method(m.address, m.argv, method.user_data);
+  stats_.handler_latency.record(monotonic_ns() - start_ns);
+#else
+  method.method(m.address, m.argv, method.user_data);
+#endif // TNYOSC_STATS
+}
+
+#if TNYOSC_STATS
+DispatchStats Dispatcher::stats() const
+{
+  DispatchStats snapshot = stats_;
+  snapshot.methods.resize(bindings_.size());
+  for (size_t i = 0; i < bindings_.size(); ++i) {
+    snapshot.methods[i].address = index_.address(i);
+    snapshot.methods[i].match_attempts =
+      method_counts_.back() - method_counts_[i * 2];
+    snapshot.methods[i].match_hits = method_counts_[i * 2 + 1];
+  }
+  return snapshot;
+}
+
+void Dispatcher::reset_stats()
+{
+  stats_ = DispatchStats();
+  std::fill(method_counts_.begin(), method_counts_.end(), 0);
+}
+
+static void append_latency(Bundle& bundle, const std::string& address,
+    const LatencyHistogram& h)
+{
+  Message msg(address);
+  msg.append((int64_t)h.count);
+  msg.append((int64_t)h.percentile(50.0));
+  msg.append((int64_t)h.percentile(99.0));
+  msg.append((int64_t)h.max_ns);
+  bundle.append(msg);
+}
+
+void Dispatcher::publish_stats(Bundle& bundle, const char* prefix) const
+{
+  DispatchStats snapshot = stats();
+  std::string base(prefix);
+
+  Message counters(base + "/counters");
+  counters.append((int64_t)snapshot.packets);
+  counters.append((int64_t)snapshot.messages);
+  counters.append((int64_t)snapshot.callbacks);
+  bundle.append(counters);
+
+  Message errors(base + "/decode_errors");
+  for (int i = kDecodeOk + 1; i < kNumDecodeErrors; ++i) {
+    errors.append((int64_t)snapshot.decode_errors[i]);
+  }
+  bundle.append(errors);
+
+  // latency messages carry count, p50, p99 and max in nanoseconds
+  append_latency(bundle, base + "/decode_latency", snapshot.decode_latency);
+  append_latency(bundle, base + "/match_latency", snapshot.match_latency);
+  append_latency(bundle, base + "/handler_latency", snapshot.handler_latency);
+
+  for (size_t i = 0; i < snapshot.methods.size(); ++i) {
+    Message method(base + "/method");
+    method.append(snapshot.methods[i].address);
+    method.append((int64_t)snapshot.methods[i].match_attempts);
+    method.append((int64_t)snapshot.methods[i].match_hits);
+    bundle.append(method);
+  }
+}
+#endif // TNYOSC_STATS
+
 struct timeval ntp_to_unixtime(uint32_t sec, uint32_t frac)
 {
   // time between 1-1-1900 and 1-1-1950
@@ -180,13 +1027,19 @@ struct timeval ntp_to_unixtime(uint32_t sec, uint32_t frac)
 const struct timeval Dispatcher::kZeroTimetag = {0, 0};
 
 bool Dispatcher::decode_data(const char* data, size_t size, 
-    std::list<ParsedMessage>& messages, struct timeval timetag)
+    std::list<ParsedMessage>& messages, struct timeval timetag,
+    DecodeError* error, SignatureCache* signatures)
 {
-  if (!memcmp(data, "#bundle\0", 8)) {
+  TNYOSC_AUDIT_SCOPE("Dispatcher::decode_data");
+  if (size >= 8 && !memcmp(data, "#bundle\0", 8)) {
     // found a bundle
 #if TNYOSC_DEBUG
     std::cerr << __FUNCTION__ << ": bundle" << std::endl;
 #endif // TNYOSC_DEBUG
+    if (size < 16) {
+      if (error) *error = kDecodeBadBundle;
+      return false;
+    }
     data += 8; size -= 8;
 
     uint32_t sec, frac;
@@ -199,39 +1052,199 @@ bool Dispatcher::decode_data(const char* data, size_t size,
 
     while (size != 0) {
       uint32_t seg_size;
+      if (size < 4) {
+        if (error) *error = kDecodeBadBundle;
+        return false;
+      }
       memcpy(&seg_size, data, 4); data += 4; size -= 4;
       seg_size = ntohl(seg_size);
-      if (seg_size > size) return false;
-      if (!decode_data(data, seg_size, messages, new_timetag)) return false;
+      if (seg_size > size) {
+        if (error) *error = kDecodeBadBundle;
+        return false;
+      }
+      if (!decode_data(data, seg_size, messages, new_timetag, error,
+            signatures)) {
+        return false;
+      }
       data += seg_size; size -= seg_size;
     }
   } else {
 #if TNYOSC_DEBUG
     std::cerr << __FUNCTION__ << ": osc" << std::endl;
 #endif // TNYOSC_DEBUG
-    if (!decode_osc(data, size, messages, timetag)) return false;
+    if (!decode_osc(data, size, messages, timetag, error, signatures)) {
+      return false;
+    }
   }
 
   return true;
 }
 
+bool Dispatcher::index_packet(const char* data, size_t size,
+    std::vector<PacketElement>& elements, struct timeval timetag,
+    DecodeError* error)
+{
+  TNYOSC_AUDIT_SCOPE("Dispatcher::index_packet");
+  if (size < 8 || memcmp(data, "#bundle\0", 8)) {
+    PacketElement element;
+    element.data = data;
+    element.size = size;
+    element.timetag = timetag;
+    elements.push_back(element);
+    return true;
+  }
+
+  if (size < 16) {
+    if (error) *error = kDecodeBadBundle;
+    return false;
+  }
+  uint32_t sec, frac;
+  memcpy(&sec, data + 8, 4);
+  memcpy(&frac, data + 12, 4);
+  struct timeval new_timetag = ntp_to_unixtime(ntohl(sec), ntohl(frac));
+  data += 16; size -= 16;
+
+  while (size != 0) {
+    uint32_t seg_size;
+    if (size < 4) {
+      if (error) *error = kDecodeBadBundle;
+      return false;
+    }
+    memcpy(&seg_size, data, 4); data += 4; size -= 4;
+    seg_size = ntohl(seg_size);
+    if (seg_size > size) {
+      if (error) *error = kDecodeBadBundle;
+      return false;
+    }
+    if (!index_packet(data, seg_size, elements, new_timetag, error)) {
+      return false;
+    }
+    data += seg_size; size -= seg_size;
+  }
+  return true;
+}
+
+// Decodes the arguments of m from index first on, starting at head with
+// remain bytes left in the message.
+static bool decode_arguments(ParsedMessage& m, unsigned int first,
+    const char* head, size_t remain, DecodeError* error)
+{
+  uint32_t int32;
+  size_t size;
+  SignatureLayout::decode_function decode;
+  // '[' whose matching ']' has not been seen yet, with their data start
+  std::vector<std::pair<unsigned int, const char*> > open_arrays;
+  for (unsigned int j = first; j < m.types.size(); j++) {
+    Argument& arg = m.argv[j];
+    arg.type = m.types[j];
+    switch (arg.type) {
+      case '[':
+        // the array size is known when the matching ']' is found
+        open_arrays.push_back(std::make_pair(j, head));
+        break;
+      case ']':
+        {
+          if (open_arrays.empty()) {
+            if (error) *error = kDecodeBadTypes;
+            return false;
+          }
+          Argument& array = m.argv[open_arrays.back().first];
+          const char* start = open_arrays.back().second;
+          open_arrays.pop_back();
+          array.size = head - start;
+          array.data.b = start;
+        }
+        break;
+      case 'b':
+        if (remain < 4) {
+          if (error) *error = kDecodeBadArgument;
+          return false;
+        }
+        memcpy(&int32, head, 4);
+        head += 4; 
+        remain -= 4;
+        int32 = ntohl(int32);
+        if (int32 > remain) {
+          if (error) *error = kDecodeBadArgument;
+          return false;
+        }
+        arg.data.b = head;
+        arg.size = int32;
+        head += int32; 
+        remain -= int32;
+        break;
+      case 's':
+      case 'S':
+        {
+          const char* end = (const char*)memchr(head, '\0', remain);
+          size = end ? end - head : remain;
+          if (end == NULL || size + (4 - size % 4) > remain) {
+            if (error) *error = kDecodeBadArgument;
+            return false;
+          }
+          arg.data.s = head;
+          arg.size = size;
+          size += 4 - size % 4;
+          head += size;
+          remain -= size;
+        }
+        break;
+      default:
+        fixed_argument(arg.type, &size, &decode);
+        if (size > remain) {
+          if (error) *error = kDecodeBadArgument;
+          return false;
+        }
+        decode(head, arg);
+        head += size;
+        remain -= size;
+        break;
+    }
+  }
+
+  if (!open_arrays.empty()) {
+    if (error) *error = kDecodeBadTypes;
+    return false;
+  }
+  return true;
+}
+
 bool Dispatcher::decode_osc(const char* data, size_t size,
-    std::list<ParsedMessage>& messages, struct timeval timetag)
+    std::list<ParsedMessage>& messages, struct timeval timetag,
+    DecodeError* error, SignatureCache* signatures)
+{
+  messages.push_back(ParsedMessage());
+  if (!decode_message(data, size, messages.back(), timetag, error,
+        signatures)) {
+    messages.pop_back();
+    return false;
+  }
+  return true;
+}
+
+bool Dispatcher::decode_message(const char* data, size_t size,
+    ParsedMessage& m, struct timeval timetag, DecodeError* error,
+    SignatureCache* signatures)
 {
   const char* head;
   const char* tail;
   unsigned int i = 0;
   size_t remain = size;
 
-  ParsedMessage m;
   m.timetag = timetag;
 
   // extract address
   head = tail = data;
+  if (remain == 0) {
+    if (error) *error = kDecodeBadAddress;
+    return false;
+  }
   while (tail[i] != '\0' && ++i < remain);
-  if (i == remain) return false;
-  m.address.resize(i);
-  std::copy(head, head+i, m.address.begin());
+  if (i == remain || i + (4 - i % 4) > remain) {
+    if (error) *error = kDecodeBadAddress;
+    return false;
+  }
+  m.address.assign(head, i);
   head += i + (4 - i % 4);
   remain = size - (head - data);
 #if TNYOSC_DEBUG
@@ -241,84 +1254,45 @@ bool Dispatcher::decode_osc(const char* data, size_t size,
   // extract types
   i = 0; 
   tail = head;
-  if (head[i++] != ',') return false;
-  while (tail[i] != '\0' && ++i < remain);
-  if (i == remain) return false;
-  m.types.resize(i-1);
-  std::copy(head+1, head+i, m.types.begin());
+  if (remain == 0 || head[i++] != ',') {
+    if (error) *error = kDecodeBadTypes;
+    return false;
+  }
+  while (i < remain && tail[i] != '\0' && ++i < remain);
+  if (i == remain || i + (4 - i % 4) > remain) {
+    if (error) *error = kDecodeBadTypes;
+    return false;
+  }
+  const char* types = head + 1;
+  size_t num_types = i - 1;
+  m.types.assign(types, num_types);
   head += i + (4 - i % 4);
   remain = size - (head - data);
 #if TNYOSC_DEBUG
   std::cerr << __FUNCTION__ << ": types = " << m.types << std::endl;
 #endif // TNYOSC_DEBUG
 
-  // extract data
-  uint32_t int32;
-  uint64_t int64;
+  // extract data; m may be reused, so old arguments are released first
+  m.argv.clear();
   m.argv.resize(m.types.size());
-  for (unsigned int j = 0; j < m.types.size(); j++) {
-    m.argv[j].type = m.types[j];
-    switch (m.types[j]) {
-      case 'i':
-      case 'f':
-      case 'r':
-        memcpy(&int32, head, 4); 
-        int32 = htonl(int32);
-        memcpy(&m.argv[j].data.i, &int32, 4);
-        m.argv[j].size = 4;
-        head += 4; 
-        remain -= 4;
-        break;
-      case 'b':
-        memcpy(&int32, head, 4);
-        head += 4; 
-        remain -= 4;
-        int32 = htonl(int32);
-        if (int32 > remain) return false;
-        m.argv[j].data.b = malloc(int32);
-        memcpy(m.argv[j].data.b, head, int32);
-        m.argv[j].size = int32;
-        head += int32; 
-        remain -= int32;
-        break;
-      case 's':
-      case 'S':
-        tail = head;
-        i = 0;
-        while (tail[i] != '\0' && ++i < remain);
-        m.argv[j].data.s = strndup((char*)head, i);
-        m.argv[j].size = i;
-        i += 4 - i % 4;
-        head += i;
-        remain -= i;
-        break;
-      case 'h':
-      case 'd':
-      case 't':
-        memcpy(&int64, head, 8);
-        int64 = htonll(int64);
-        memcpy(&m.argv[j].data.i, &int64, 8);
-        m.argv[j].size = 8;
-        head += 8;
-        remain -= 8;
-        break;
-      case 'c':
-        memcpy(&int32, head, 4);
-        m.argv[j].data.c = (char)htonl(int32);
-        m.argv[j].size = 1;
-        head += 4;
-        remain -= 8;
-        break;
-      case 'm':
-        memcpy(&m.argv[j].data.m, head, 4);
-        m.argv[j].size = 4;
-        head += 4;
-        remain -= 4;
-        break;
+  unsigned int first = 0;
+  if (signatures) {
+    const SignatureLayout& layout = signatures->find(types, num_types);
+    // one bounds check covers the whole fixed-size prefix
+    if (layout.fixed_size > remain) {
+      if (error) *error = kDecodeBadArgument;
+      return false;
+    }
+    for (; first < layout.slots.size(); ++first) {
+      m.argv[first].type = m.types[first];
+      layout.slots[first].decode(head + layout.slots[first].offset,
+          m.argv[first]);
     }
+    head += layout.fixed_size;
+    remain -= layout.fixed_size;
   }
+  if (!decode_arguments(m, first, head, remain, error)) return false;
 
-  messages.push_back(m);
 #if TNYOSC_DEBUG
   std::cerr << __FUNCTION__ << ": success" << std::endl;
 #endif // TNYOSC_DEBUG
@@ -332,7 +1306,7 @@ bool Dispatcher::decode_osc(const char* data, size_t size,
 // 
 //   1. '?' in the OSC Address Pattern matches any single character.
 //   2. '*' in the OSC Address Pattern matches any sequence of zero or more 
-//      characters.
+//      characters within one part of the address (it does not match '/').
 //   3. A string of characters in square brackets (e.g., "[string]") in the 
 //      OSC Address Pattern matches any character in the string. Inside square
 //      brackets, the minus sign (-) and exclamation point (!) have special 
@@ -349,96 +1323,17 @@ bool Dispatcher::decode_osc(const char* data, size_t size,
 //      strings in the list.
 //   5. Any other character in an OSC Address Pattern can match only the same 
 //      character.
+//   6. (OSC 1.1) "//" matches any number of whole parts, so "//level" matches
+//      "/level" and "/mixer/ch/1/level".
+//
+// Parts are matched one at a time, remembering which parts of lhs the
+// pattern can have reached, so no combination of wildcards backtracks (see
+// MethodIndex::match).
 //
 // @param lhs incoming OSC address pattern to match it with rhs's pattern
 // @param rhs method address pattern that may contain special characters
 bool Dispatcher::pattern_match(const std::string& lhs, const std::string& rhs)
 {
-  bool negate = false;
-  bool mismatched = false;
-  std::string::const_iterator seq_tmp;
-  std::string::const_iterator seq = lhs.begin();
-  std::string::const_iterator seq_end = lhs.end();
-  std::string::const_iterator pattern = rhs.begin();
-  std::string::const_iterator pattern_end = rhs.end();
-  while (seq != seq_end && pattern != pattern_end) {
-    switch (*pattern) {
-      case '?':
-        break;
-      case '*':
-        // if * is the last pattern, return true
-        if (++pattern == pattern_end) return true;
-        while (*seq != *pattern && seq != seq_end) ++seq;
-        // if seq reaches to the end without matching pattern
-        if (seq == seq_end) return false;
-        break;
-      case '[':
-        negate = false;
-        mismatched = false;
-        if (*(++pattern) == '!') {
-          negate = true;
-          ++pattern;
-        }
-        if (*(pattern+1) == '-') {
-          // range matching
-          char c_start = *pattern; ++pattern;
-          //assert(*pattern == '-');
-          char c_end = *(++pattern); ++pattern;
-          //assert(*pattern == ']');
-          // swap c_start and c_end if c_start is larger
-          if (c_start > c_end) {
-            char tmp = c_start;
-            c_end = c_start;
-            c_start = tmp;
-          }
-          mismatched = (c_start <= *seq && *seq <= c_end) ? negate : !negate;
-          if (mismatched) return false;
-        } else {
-          // literal matching
-          while (*pattern != ']') {
-            if (*seq == *pattern) {
-              mismatched = negate;
-              break;
-            }
-            ++pattern;
-          }
-          if (mismatched) return false;
-          while (*pattern != ']') ++pattern;
-        }
-        break;
-      case '{':
-        seq_tmp = seq;
-        mismatched = true;
-        while (*(++pattern) != '}') {
-          // this assumes that there's no sequence like "{,a}" where ',' is
-          // follows immediately after '{', which is illegal.
-          if (*pattern == ',') { 
-            mismatched = false;
-            break;
-          } else if (*seq != *pattern) {
-            // fast forward to the next ',' or '}'
-            while (*(++pattern) != ',' && *pattern != '}');
-            if (*pattern == '}') return false;
-            // redo seq matching
-            seq = seq_tmp;
-            mismatched = true;
-          } else {
-            // matched 
-            ++seq;
-            mismatched = false;
-          }
-        }
-        if (mismatched) return false;
-        while (*pattern != '}') ++pattern;
-        --seq;
-        break;
-      default: // non-special character
-        if (*seq != *pattern) return false;
-        break;
-    }
-    ++seq; ++pattern;
-  }
-  if (seq == seq_end && pattern == pattern_end) return true;
-  else return false;
+  return MethodIndex::match(lhs.data(), lhs.size(), rhs.data(), rhs.size());
 }
 
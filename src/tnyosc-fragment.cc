@@ -0,0 +1,148 @@
+
+#include "tnyosc-fragment.hpp"
+
+#include <algorithm>
+
+using namespace tnyosc;
+
+static uint64_t monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+Reassembler::Reassembler(transfer_function done, void* user_data,
+    size_t max_transfer_size, int timeout_ms)
+  : done_(done), user_data_(user_data), max_transfer_size_(max_transfer_size),
+    timeout_ns_((uint64_t)timeout_ms * 1000000)
+{
+}
+
+void Reassembler::attach(Dispatcher& dispatcher, const char* address,
+    const std::string& source)
+{
+  Source s;
+  s.reassembler = this;
+  s.key = source;
+  sources_.push_back(s);
+  dispatcher.add_method(address, "siiib", &Reassembler::fragment_method,
+      &sources_.back());
+}
+
+void Reassembler::fragment_method(const std::string&,
+    const std::vector<Argument>& argv, void* user_data)
+{
+  Source* source = (Source*)user_data;
+  source->reassembler->add(argv, source->key);
+}
+
+bool Reassembler::add(const std::vector<Argument>& argv,
+    const std::string& source)
+{
+  uint64_t now = monotonic_ns();
+  expire();
+
+  if (argv.size() != 5 || argv[0].type != 's' || argv[1].type != 'i' ||
+      argv[2].type != 'i' || argv[3].type != 'i' || argv[4].type != 'b' ||
+      argv[2].data.i < 0 || argv[3].data.i < 0) {
+    ++stats_.rejected;
+    return false;
+  }
+  uint32_t id = (uint32_t)argv[1].data.i;
+  size_t offset = argv[2].data.i;
+  size_t total = argv[3].data.i;
+  size_t size = argv[4].size;
+  if (total > max_transfer_size_ || offset > total || size > total - offset) {
+    ++stats_.rejected;
+    return false;
+  }
+
+  TransferKey key;
+  key.source = source;
+  key.address.assign(argv[0].data.s, argv[0].size);
+  key.id = id;
+  std::map<TransferKey, Transfer>::iterator t = transfers_.find(key);
+  if (t == transfers_.end()) {
+    t = transfers_.insert(std::make_pair(key, Transfer())).first;
+    t->second.data.resize(total);
+    t->second.received = 0;
+  } else if (t->second.data.size() != total) {
+    ++stats_.rejected;
+    return false;
+  }
+  Transfer& transfer = t->second;
+  transfer.last_ns = now;
+  ++stats_.fragments;
+  if (size > 0) memcpy(&transfer.data[offset], argv[4].data.b, size);
+
+  // merge [offset, end) into the received ranges
+  size_t start = offset;
+  size_t end = offset + size;
+  size_t before = transfer.received;
+  std::map<size_t, size_t>::iterator it = transfer.ranges.upper_bound(start);
+  if (it != transfer.ranges.begin()) {
+    --it;
+    if (it->second < start) ++it;
+  }
+  while (it != transfer.ranges.end() && it->first <= end) {
+    start = std::min(start, it->first);
+    end = std::max(end, it->second);
+    transfer.received -= it->second - it->first;
+    transfer.ranges.erase(it++);
+  }
+  transfer.ranges[start] = end;
+  transfer.received += end - start;
+  if (size > 0 && transfer.received == before) ++stats_.duplicates;
+
+  if (transfer.received == total) {
+    ++stats_.completed;
+    std::string address;
+    std::vector<char> data;
+    address.swap(key.address);
+    data.swap(transfer.data);
+    transfers_.erase(t);
+    // the transfer is gone before done runs, so done may add fragments
+    done_(address, data.empty() ? NULL : &data[0], data.size(), user_data_);
+  }
+  return true;
+}
+
+size_t Reassembler::expire()
+{
+  uint64_t now = monotonic_ns();
+  size_t count = 0;
+  std::map<TransferKey, Transfer>::iterator it = transfers_.begin();
+  while (it != transfers_.end()) {
+    if (now - it->second.last_ns >= timeout_ns_) {
+      transfers_.erase(it++);
+      ++count;
+    } else {
+      ++it;
+    }
+  }
+  stats_.timed_out += count;
+  return count;
+}
+
+bool Reassembler::missing(const std::string& address, uint32_t id,
+    std::vector<std::pair<size_t, size_t> >& ranges,
+    const std::string& source) const
+{
+  TransferKey key;
+  key.source = source;
+  key.address = address;
+  key.id = id;
+  std::map<TransferKey, Transfer>::const_iterator t = transfers_.find(key);
+  if (t == transfers_.end()) return false;
+  size_t next = 0;
+  std::map<size_t, size_t>::const_iterator it = t->second.ranges.begin();
+  for (; it != t->second.ranges.end(); ++it) {
+    if (it->first > next) ranges.push_back(std::make_pair(next, it->first));
+    next = it->second;
+  }
+  if (next < t->second.data.size()) {
+    ranges.push_back(std::make_pair(next, t->second.data.size()));
+  }
+  return true;
+}
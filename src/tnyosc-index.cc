@@ -0,0 +1,611 @@
+
+#include "tnyosc-index.hpp"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace tnyosc;
+
+// position of one '/'-separated part of an address
+struct Part {
+  uint32_t offset;
+  uint32_t size;
+};
+
+// addresses with up to this many parts are matched without allocating
+static const size_t kStackParts = 32;
+// part_match memoizes failures on the stack up to this many states
+static const size_t kStackStates = 1024;
+
+static size_t count_parts(const char* s, size_t size)
+{
+  return std::count(s, s + size, '/') + 1;
+}
+
+static void split_parts(const char* s, size_t size, Part* parts)
+{
+  size_t begin = 0;
+  for (size_t i = 0; i <= size; ++i) {
+    if (i == size || s[i] == '/') {
+      parts->offset = begin;
+      parts->size = i - begin;
+      ++parts;
+      begin = i + 1;
+    }
+  }
+}
+
+static bool has_wildcard(const char* s, size_t size)
+{
+  for (size_t i = 0; i < size; ++i) {
+    if (s[i] == '?' || s[i] == '*' || s[i] == '[' || s[i] == '{') return true;
+  }
+  return false;
+}
+
+// Matches part[si..] against pattern[pi..]. Only '*' and '{' can match in
+// more than one way, and a failed (pi, si) state is remembered in failed
+// so no state is tried twice.
+struct PartMatcher {
+  const char* s;
+  size_t n;
+  const char* p;
+  size_t m;
+  unsigned char* failed; // (m + 1) * (n + 1) flags
+
+  bool from(size_t pi, size_t si) {
+    unsigned char& memo = failed[pi * (n + 1) + si];
+    if (memo) return false;
+    if (match(pi, si)) return true;
+    memo = 1;
+    return false;
+  }
+
+  bool match(size_t pi, size_t si) {
+    while (pi < m) {
+      char c = p[pi];
+      if (c == '*') {
+        while (pi < m && p[pi] == '*') ++pi;
+        if (pi == m) return true;
+        for (size_t k = si; k <= n; ++k) {
+          if (from(pi, k)) return true;
+        }
+        return false;
+      }
+      if (c == '{') {
+        size_t close = pi + 1;
+        while (close < m && p[close] != '}') ++close;
+        if (close < m) {
+          size_t a = pi + 1;
+          for (size_t b = a; b <= close; ++b) {
+            if (b < close && p[b] != ',') continue;
+            size_t len = b - a;
+            if (len <= n - si && memcmp(s + si, p + a, len) == 0 &&
+                from(close + 1, si + len)) {
+              return true;
+            }
+            a = b + 1;
+          }
+          return false;
+        }
+      }
+      if (si == n) return false;
+      if (c == '[') {
+        size_t j = pi + 1;
+        bool negate = j < m && p[j] == '!';
+        if (negate) ++j;
+        size_t close = j;
+        while (close < m && p[close] != ']') ++close;
+        if (close < m) {
+          bool found = false;
+          for (size_t q = j; q < close;) {
+            if (q + 2 < close && p[q + 1] == '-') {
+              char lo = std::min(p[q], p[q + 2]);
+              char hi = std::max(p[q], p[q + 2]);
+              if (lo <= s[si] && s[si] <= hi) found = true;
+              q += 3;
+            } else {
+              if (p[q] == s[si]) found = true;
+              ++q;
+            }
+          }
+          if (found == negate) return false;
+          pi = close + 1;
+          ++si;
+          continue;
+        }
+      }
+      if (c != '?' && c != s[si]) return false;
+      ++pi;
+      ++si;
+    }
+    return si == n;
+  }
+};
+
+const uint32_t MethodIndex::kNone;
+
+// snapshot files start with this header, and every array follows at the
+// file offset given in it, aligned to 8 bytes
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t byte_order; // kByteOrder on the host that wrote the file
+  uint32_t num_nodes;
+  uint32_t num_methods;
+  uint32_t edge_slots;
+  uint32_t num_edges;
+  uint32_t strings_size;
+  uint64_t nodes;
+  uint64_t methods;
+  uint64_t edges;
+  uint64_t strings;
+  uint64_t size; // of the whole file
+};
+
+static const char kSnapshotMagic[8] = {'t', 'n', 'y', 'o', 's', 'c', 'I', '1'};
+static const uint32_t kByteOrder = 0x01020304;
+
+static uint64_t align8(uint64_t offset)
+{
+  return (offset + 7) & ~(uint64_t)7;
+}
+
+// a snapshot mapped by load, shared by copies of the index
+struct MethodIndex::Mapping {
+  void* address;
+  size_t size;
+
+  Mapping() : address(NULL), size(0) {}
+  ~Mapping() { if (address) munmap(address, size); }
+};
+
+MethodIndex::MethodIndex()
+{
+  clear();
+}
+
+MethodIndex::MethodIndex(const MethodIndex& other)
+{
+  *this = other;
+}
+
+MethodIndex& MethodIndex::operator=(const MethodIndex& other)
+{
+  if (this == &other) return *this;
+  node_array_ = other.node_array_;
+  method_array_ = other.method_array_;
+  edge_array_ = other.edge_array_;
+  string_array_ = other.string_array_;
+  num_edges_ = other.num_edges_;
+  mapping_ = other.mapping_;
+  if (mapping_) {
+    nodes_ = other.nodes_;
+    num_nodes_ = other.num_nodes_;
+    methods_ = other.methods_;
+    num_methods_ = other.num_methods_;
+    edges_ = other.edges_;
+    edge_slots_ = other.edge_slots_;
+    strings_ = other.strings_;
+    strings_size_ = other.strings_size_;
+  } else {
+    refresh();
+  }
+  return *this;
+}
+
+void MethodIndex::clear()
+{
+  Node root;
+  root.name = 0;
+  root.name_size = 0;
+  root.parent = kNone;
+  root.patterns = kNone;
+  root.next = kNone;
+  root.methods = kNone;
+  root.flags = 0;
+  node_array_.assign(1, root);
+  method_array_.clear();
+  edge_array_.clear();
+  string_array_.clear();
+  num_edges_ = 0;
+  mapping_.reset();
+  refresh();
+}
+
+void MethodIndex::refresh()
+{
+  nodes_ = &node_array_[0];
+  num_nodes_ = node_array_.size();
+  methods_ = method_array_.empty() ? NULL : &method_array_[0];
+  num_methods_ = method_array_.size();
+  edges_ = edge_array_.empty() ? NULL : &edge_array_[0];
+  edge_slots_ = edge_array_.size();
+  strings_ = string_array_.empty() ? "" : &string_array_[0];
+  strings_size_ = string_array_.size();
+}
+
+void MethodIndex::own()
+{
+  if (!mapping_) return;
+  node_array_.assign(nodes_, nodes_ + num_nodes_);
+  method_array_.assign(methods_, methods_ + num_methods_);
+  edge_array_.assign(edges_, edges_ + edge_slots_);
+  string_array_.assign(strings_, strings_ + strings_size_);
+  mapping_.reset();
+  refresh();
+}
+
+uint32_t MethodIndex::edge_hash(uint32_t parent, const char* name,
+    size_t size)
+{
+  // FNV-1a over the parent index and the name
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < 4; ++i) {
+    h = (h ^ ((parent >> (i * 8)) & 0xff)) * 16777619u;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  }
+  return h;
+}
+
+uint32_t MethodIndex::find_literal(uint32_t parent, const char* name,
+    size_t size) const
+{
+  if (edge_slots_ == 0) return kNone;
+  size_t mask = edge_slots_ - 1;
+  for (size_t h = edge_hash(parent, name, size) & mask; edges_[h] != kNone;
+      h = (h + 1) & mask) {
+    const Node& node = nodes_[edges_[h]];
+    if (node.parent == parent && node.name_size == size &&
+        memcmp(strings_ + node.name, name, size) == 0) {
+      return edges_[h];
+    }
+  }
+  return kNone;
+}
+
+void MethodIndex::grow_edges()
+{
+  std::vector<uint32_t> edges(edge_slots_ == 0 ? 16 : edge_slots_ * 2, kNone);
+  size_t mask = edges.size() - 1;
+  for (size_t i = 0; i < edge_slots_; ++i) {
+    if (edges_[i] == kNone) continue;
+    const Node& node = nodes_[edges_[i]];
+    size_t h = edge_hash(node.parent, strings_ + node.name, node.name_size);
+    for (h &= mask; edges[h] != kNone; h = (h + 1) & mask);
+    edges[h] = edges_[i];
+  }
+  edge_array_.swap(edges);
+  refresh();
+}
+
+uint32_t MethodIndex::add_string(const char* s, size_t size)
+{
+  uint32_t offset = string_array_.size();
+  string_array_.insert(string_array_.end(), s, s + size);
+  refresh();
+  return offset;
+}
+
+uint32_t MethodIndex::add_child(uint32_t parent, const char* name,
+    size_t size, uint32_t flags)
+{
+  if (flags == 0) {
+    uint32_t child = find_literal(parent, name, size);
+    if (child != kNone) return child;
+  } else {
+    for (uint32_t c = nodes_[parent].patterns; c != kNone; c = nodes_[c].next) {
+      const Node& node = nodes_[c];
+      if (node.flags == flags && node.name_size == size &&
+          memcmp(strings_ + node.name, name, size) == 0) {
+        return c;
+      }
+    }
+  }
+
+  Node node;
+  node.name = add_string(name, size);
+  node.name_size = size;
+  node.parent = parent;
+  node.patterns = kNone;
+  node.next = kNone;
+  node.methods = kNone;
+  node.flags = flags;
+  uint32_t child = node_array_.size();
+  if (flags == 0) {
+    node_array_.push_back(node);
+    refresh();
+    if ((num_edges_ + 1) * 2 > edge_slots_) grow_edges();
+    size_t mask = edge_slots_ - 1;
+    size_t h = edge_hash(parent, name, size) & mask;
+    for (; edge_array_[h] != kNone; h = (h + 1) & mask);
+    edge_array_[h] = child;
+    ++num_edges_;
+  } else {
+    node.next = node_array_[parent].patterns;
+    node_array_.push_back(node);
+    node_array_[parent].patterns = child;
+    refresh();
+  }
+  return child;
+}
+
+uint32_t MethodIndex::add(const std::string& address,
+    const std::string& types)
+{
+  own();
+  const char* s = address.data();
+  size_t size = address.size();
+  uint32_t node = 0;
+  size_t begin = 0;
+  for (size_t k = 0;; ++k) {
+    size_t end = begin;
+    while (end < size && s[end] != '/') ++end;
+    uint32_t flags = 0;
+    // an empty part other than the first and the last comes from "//"
+    if (k > 0 && end == begin && end < size) {
+      flags = kPattern | kTraverse;
+    } else if (has_wildcard(s + begin, end - begin)) {
+      flags = kPattern;
+    }
+    node = add_child(node, s + begin, end - begin, flags);
+    if (end == size) break;
+    begin = end + 1;
+  }
+
+  Method method;
+  method.address = add_string(s, size);
+  method.address_size = size;
+  method.types = add_string(types.data(), types.size());
+  method.types_size = types.size();
+  method.next = node_array_[node].methods;
+  uint32_t number = method_array_.size();
+  method_array_.push_back(method);
+  node_array_[node].methods = number;
+  refresh();
+  return number;
+}
+
+std::string MethodIndex::address(uint32_t method) const
+{
+  const Method& m = methods_[method];
+  return std::string(strings_ + m.address, m.address_size);
+}
+
+bool MethodIndex::accepts(uint32_t method, const std::string& types) const
+{
+  const Method& m = methods_[method];
+  return m.types_size == 0 || (m.types_size == types.size() &&
+      memcmp(strings_ + m.types, types.data(), m.types_size) == 0);
+}
+
+void MethodIndex::find(const std::string& address,
+    std::vector<uint32_t>& methods) const
+{
+  const char* s = address.data();
+  std::vector<Part> parts(count_parts(s, address.size()));
+  split_parts(s, address.size(), &parts[0]);
+  uint32_t n = parts.size();
+  size_t first = methods.size();
+
+  // (node, part) states still to expand. A node is only reached from its
+  // parent, so each state is pushed once, except under "//" nodes, which
+  // are entered at several parts and tracked in traversed.
+  std::vector<std::pair<uint32_t, uint32_t> > pending;
+  // "//" nodes entered so far and the first part each was expanded from
+  std::vector<std::pair<uint32_t, uint32_t> > traversed;
+  pending.push_back(std::make_pair(0u, 0u));
+  while (!pending.empty()) {
+    uint32_t index = pending.back().first;
+    uint32_t i = pending.back().second;
+    pending.pop_back();
+    const Node& node = nodes_[index];
+    if (i == n) {
+      for (uint32_t m = node.methods; m != kNone; m = methods_[m].next) {
+        methods.push_back(m);
+      }
+    } else {
+      uint32_t child = find_literal(index, s + parts[i].offset, parts[i].size);
+      if (child != kNone) pending.push_back(std::make_pair(child, i + 1));
+    }
+    for (uint32_t c = node.patterns; c != kNone; c = nodes_[c].next) {
+      const Node& pattern = nodes_[c];
+      if (pattern.flags & kTraverse) {
+        // "//" consumes any number of parts, so its children are tried from
+        // every part after i; skip the parts an earlier entry has covered
+        size_t t = 0;
+        while (t < traversed.size() && traversed[t].first != c) ++t;
+        uint32_t end = n + 1;
+        if (t == traversed.size()) {
+          traversed.push_back(std::make_pair(c, i));
+        } else {
+          end = traversed[t].second;
+          if (i >= end) continue;
+          traversed[t].second = i;
+        }
+        for (uint32_t j = i; j < end; ++j) {
+          pending.push_back(std::make_pair(c, j));
+        }
+      } else if (i < n && part_match(s + parts[i].offset, parts[i].size,
+            strings_ + pattern.name, pattern.name_size)) {
+        pending.push_back(std::make_pair(c, i + 1));
+      }
+    }
+  }
+  std::sort(methods.begin() + first, methods.end());
+}
+
+bool MethodIndex::save(const char* path) const
+{
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.byte_order = kByteOrder;
+  header.num_nodes = num_nodes_;
+  header.num_methods = num_methods_;
+  header.edge_slots = edge_slots_;
+  header.num_edges = num_edges_;
+  header.strings_size = strings_size_;
+  header.nodes = align8(sizeof(header));
+  header.methods = align8(header.nodes + num_nodes_ * sizeof(Node));
+  header.edges = align8(header.methods + num_methods_ * sizeof(Method));
+  header.strings = align8(header.edges + edge_slots_ * sizeof(uint32_t));
+  header.size = header.strings + strings_size_;
+
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) return false;
+  const char zeros[8] = {0};
+  uint64_t offset = 0;
+  struct { uint64_t offset; const void* data; size_t size; } parts[] = {
+    {0, &header, sizeof(header)},
+    {header.nodes, nodes_, num_nodes_ * sizeof(Node)},
+    {header.methods, methods_, num_methods_ * sizeof(Method)},
+    {header.edges, edges_, edge_slots_ * sizeof(uint32_t)},
+    {header.strings, strings_, strings_size_}
+  };
+  bool ok = true;
+  for (size_t i = 0; ok && i < sizeof(parts) / sizeof(parts[0]); ++i) {
+    size_t padding = parts[i].offset - offset;
+    ok = fwrite(zeros, 1, padding, file) == padding &&
+      fwrite(parts[i].data, 1, parts[i].size, file) == parts[i].size;
+    offset = parts[i].offset + parts[i].size;
+  }
+  if (fclose(file) != 0) ok = false;
+  return ok;
+}
+
+// true if count elements of size bytes at offset lie within a file of
+// file_size bytes
+static bool in_file(uint64_t offset, uint64_t count, size_t size,
+    uint64_t file_size)
+{
+  return offset % 8 == 0 && offset <= file_size &&
+    count <= (file_size - offset) / size;
+}
+
+bool MethodIndex::load(const char* path)
+{
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+    ::close(fd);
+    return false;
+  }
+  void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return false;
+  std::tr1::shared_ptr<Mapping> mapping(new Mapping());
+  mapping->address = p;
+  mapping->size = st.st_size;
+
+  const SnapshotHeader& header = *(const SnapshotHeader*)p;
+  uint64_t size = st.st_size;
+  if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 ||
+      header.byte_order != kByteOrder || header.size != size ||
+      header.num_nodes == 0 ||
+      (header.edge_slots & (header.edge_slots - 1)) != 0 ||
+      (header.edge_slots != 0 && header.num_edges >= header.edge_slots) ||
+      !in_file(header.nodes, header.num_nodes, sizeof(Node), size) ||
+      !in_file(header.methods, header.num_methods, sizeof(Method), size) ||
+      !in_file(header.edges, header.edge_slots, sizeof(uint32_t), size) ||
+      header.strings > size || header.strings_size != size - header.strings) {
+    return false;
+  }
+
+  const char* base = (const char*)p;
+  node_array_.clear();
+  method_array_.clear();
+  edge_array_.clear();
+  string_array_.clear();
+  nodes_ = (const Node*)(base + header.nodes);
+  num_nodes_ = header.num_nodes;
+  methods_ = (const Method*)(base + header.methods);
+  num_methods_ = header.num_methods;
+  edges_ = (const uint32_t*)(base + header.edges);
+  edge_slots_ = header.edge_slots;
+  num_edges_ = header.num_edges;
+  strings_ = base + header.strings;
+  strings_size_ = header.strings_size;
+  mapping_ = mapping;
+  return true;
+}
+
+bool MethodIndex::part_match(const char* part, size_t part_size,
+    const char* pattern, size_t pattern_size)
+{
+  PartMatcher matcher;
+  matcher.s = part;
+  matcher.n = part_size;
+  matcher.p = pattern;
+  matcher.m = pattern_size;
+  size_t states = (pattern_size + 1) * (part_size + 1);
+  unsigned char stack_failed[kStackStates];
+  std::vector<unsigned char> heap_failed;
+  if (states <= kStackStates) {
+    memset(stack_failed, 0, states);
+    matcher.failed = stack_failed;
+  } else {
+    heap_failed.resize(states, 0);
+    matcher.failed = &heap_failed[0];
+  }
+  return matcher.match(0, 0);
+}
+
+bool MethodIndex::match(const char* address, size_t address_size,
+    const char* pattern, size_t pattern_size)
+{
+  size_t n = count_parts(address, address_size);
+  Part stack_parts[kStackParts];
+  char stack_reach[(kStackParts + 1) * 2];
+  std::vector<Part> heap_parts;
+  std::vector<char> heap_reach;
+  Part* parts = stack_parts;
+  char* reach = stack_reach;
+  if (n > kStackParts) {
+    heap_parts.resize(n);
+    heap_reach.resize((n + 1) * 2);
+    parts = &heap_parts[0];
+    reach = &heap_reach[0];
+  }
+  split_parts(address, address_size, parts);
+
+  // reach[i] is set if the pattern so far matches the first i parts
+  char* next = reach + n + 1;
+  memset(reach, 0, n + 1);
+  reach[0] = 1;
+  size_t begin = 0;
+  for (size_t k = 0;; ++k) {
+    size_t end = begin;
+    while (end < pattern_size && pattern[end] != '/') ++end;
+    bool any = false;
+    if (k > 0 && end == begin && end < pattern_size) {
+      // "//" reaches every part after the first one reached
+      for (size_t i = 0; i <= n; ++i) {
+        any = any || reach[i];
+        reach[i] = any;
+      }
+    } else {
+      memset(next, 0, n + 1);
+      for (size_t i = 0; i < n; ++i) {
+        if (reach[i] && part_match(address + parts[i].offset, parts[i].size,
+              pattern + begin, end - begin)) {
+          next[i + 1] = 1;
+          any = true;
+        }
+      }
+      std::swap(reach, next);
+    }
+    if (!any) return false;
+    if (end == pattern_size) break;
+    begin = end + 1;
+  }
+  return reach[n];
+}
@@ -0,0 +1,159 @@
+
+#include "tnyosc-jitter.hpp"
+
+#include <algorithm>
+
+using namespace tnyosc;
+
+// the jitter peak decays by 1/kPeakRelease of its excess per message
+static const int64_t kPeakRelease = 256;
+
+ClockEstimator::ClockEstimator(int64_t bin_us, size_t window)
+  : bin_us_(bin_us > 0 ? bin_us : 1), window_(window > 1 ? window : 2),
+    origin_us_(0), intercept_(0), slope_(0)
+{
+}
+
+void ClockEstimator::add(int64_t remote_us, int64_t local_us)
+{
+  int64_t delta = local_us - remote_us;
+  if (bins_.empty() || local_us - bins_.back().start_us >= bin_us_) {
+    Bin bin;
+    bin.start_us = local_us;
+    bin.remote_us = remote_us;
+    bin.delta_us = delta;
+    bins_.push_back(bin);
+    if (bins_.size() > window_) bins_.pop_front();
+  } else if (delta < bins_.back().delta_us) {
+    bins_.back().remote_us = remote_us;
+    bins_.back().delta_us = delta;
+  } else {
+    return;
+  }
+  fit();
+}
+
+void ClockEstimator::fit()
+{
+  // least squares line through the bin minima, centered for precision
+  size_t n = bins_.size();
+  double mean_x = 0, mean_y = 0;
+  origin_us_ = bins_.front().remote_us;
+  for (size_t i = 0; i < n; ++i) {
+    mean_x += bins_[i].remote_us - origin_us_;
+    mean_y += bins_[i].delta_us;
+  }
+  mean_x /= n;
+  mean_y /= n;
+  double sxx = 0, sxy = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double x = bins_[i].remote_us - origin_us_ - mean_x;
+    sxx += x * x;
+    sxy += x * (bins_[i].delta_us - mean_y);
+  }
+  if (n < 2 || sxx == 0) {
+    slope_ = 0;
+    intercept_ = bins_.back().delta_us;
+    for (size_t i = 0; i < n; ++i) {
+      intercept_ = std::min(intercept_, (double)bins_[i].delta_us);
+    }
+    return;
+  }
+  slope_ = sxy / sxx;
+  intercept_ = mean_y - slope_ * mean_x;
+}
+
+int64_t ClockEstimator::offset(int64_t remote_us) const
+{
+  if (bins_.empty()) return 0;
+  return (int64_t)(intercept_ + slope_ * (remote_us - origin_us_));
+}
+
+int64_t ClockEstimator::to_local(int64_t remote_us) const
+{
+  return remote_us + offset(remote_us);
+}
+
+JitterBuffer::JitterBuffer(int64_t min_latency_us, int64_t max_latency_us)
+  : min_latency_us_(min_latency_us), max_latency_us_(max_latency_us),
+    seq_(0)
+{
+}
+
+void JitterBuffer::push(uint64_t source, const CallbackRef& callback,
+    int64_t now_us)
+{
+  std::map<uint64_t, Source>::iterator it = sources_.find(source);
+  if (it == sources_.end()) {
+    Source s;
+    s.peak_us = 0;
+    s.stats.latency_us = min_latency_us_;
+    it = sources_.insert(std::make_pair(source, s)).first;
+  }
+  Source& s = it->second;
+
+  Entry entry;
+  entry.seq = seq_++;
+  entry.callback = callback;
+  const struct timeval& tv = callback->timetag;
+  if (tv.tv_sec == 0 && tv.tv_usec == 0) {
+    ++s.stats.immediate;
+    entry.release_us = now_us;
+    heap_.push_back(entry);
+    std::push_heap(heap_.begin(), heap_.end(), LaterEntry());
+    return;
+  }
+
+  int64_t remote_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  s.clock.add(remote_us, now_us);
+  int64_t due_us = s.clock.to_local(remote_us);
+  ++s.stats.received;
+
+  entry.release_us = due_us + s.stats.latency_us;
+  if (entry.release_us < now_us) {
+    int64_t late = now_us - entry.release_us;
+    ++s.stats.late;
+    s.stats.total_late_us += late;
+    s.stats.max_late_us = std::max(s.stats.max_late_us, late);
+    entry.release_us = now_us;
+  }
+
+  // adapt the target to the network delay above the best case seen,
+  // tracked with fast attack and slow release
+  int64_t excess = now_us - due_us;
+  if (excess > s.peak_us) {
+    s.peak_us = excess;
+  } else {
+    s.peak_us -= (s.peak_us - std::max<int64_t>(excess, 0)) / kPeakRelease;
+  }
+  s.stats.latency_us = std::min(max_latency_us_,
+      std::max(min_latency_us_, s.peak_us + min_latency_us_));
+  s.stats.offset_us = s.clock.offset(remote_us);
+  s.stats.drift_ppm = s.clock.drift_ppm();
+
+  heap_.push_back(entry);
+  std::push_heap(heap_.begin(), heap_.end(), LaterEntry());
+}
+
+size_t JitterBuffer::pop(int64_t now_us, std::list<CallbackRef>& out)
+{
+  size_t count = 0;
+  while (!heap_.empty() && heap_.front().release_us <= now_us) {
+    std::pop_heap(heap_.begin(), heap_.end(), LaterEntry());
+    out.push_back(heap_.back().callback);
+    heap_.pop_back();
+    ++count;
+  }
+  return count;
+}
+
+int64_t JitterBuffer::next_release() const
+{
+  return heap_.empty() ? -1 : heap_.front().release_us;
+}
+
+JitterSourceStats JitterBuffer::source_stats(uint64_t source) const
+{
+  std::map<uint64_t, Source>::const_iterator it = sources_.find(source);
+  return it == sources_.end() ? JitterSourceStats() : it->second.stats;
+}
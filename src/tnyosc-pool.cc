@@ -0,0 +1,88 @@
+
+#include "tnyosc-pool.hpp"
+
+using namespace tnyosc;
+
+WorkerPool::WorkerPool(size_t num_threads)
+  : generation_(0), busy_(0), stop_(false),
+    task_(NULL), arg_(NULL), count_(0), next_(0)
+{
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&start_cond_, NULL);
+  pthread_cond_init(&done_cond_, NULL);
+  threads_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &WorkerPool::thread_main, this) != 0) {
+      break;
+    }
+    threads_.push_back(thread);
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  pthread_mutex_lock(&mutex_);
+  stop_ = true;
+  pthread_cond_broadcast(&start_cond_);
+  pthread_mutex_unlock(&mutex_);
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    pthread_join(threads_[i], NULL);
+  }
+  pthread_cond_destroy(&done_cond_);
+  pthread_cond_destroy(&start_cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void WorkerPool::run(task_function task, void* arg, size_t count)
+{
+  if (count == 0) return;
+
+  pthread_mutex_lock(&mutex_);
+  task_ = task;
+  arg_ = arg;
+  count_ = count;
+  next_ = 0;
+  busy_ = threads_.size();
+  ++generation_;
+  pthread_cond_broadcast(&start_cond_);
+  pthread_mutex_unlock(&mutex_);
+
+  work();
+
+  pthread_mutex_lock(&mutex_);
+  while (busy_ > 0) pthread_cond_wait(&done_cond_, &mutex_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+void WorkerPool::work()
+{
+  size_t index;
+  while ((index = __sync_fetch_and_add(&next_, 1)) < count_) {
+    task_(arg_, index);
+  }
+}
+
+void* WorkerPool::thread_main(void* pool)
+{
+  WorkerPool* self = (WorkerPool*)pool;
+  unsigned int seen = 0;
+  for (;;) {
+    pthread_mutex_lock(&self->mutex_);
+    while (!self->stop_ && self->generation_ == seen) {
+      pthread_cond_wait(&self->start_cond_, &self->mutex_);
+    }
+    if (self->stop_) {
+      pthread_mutex_unlock(&self->mutex_);
+      return NULL;
+    }
+    seen = self->generation_;
+    pthread_mutex_unlock(&self->mutex_);
+
+    self->work();
+
+    pthread_mutex_lock(&self->mutex_);
+    if (--self->busy_ == 0) pthread_cond_signal(&self->done_cond_);
+    pthread_mutex_unlock(&self->mutex_);
+  }
+}
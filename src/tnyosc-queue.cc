@@ -0,0 +1,207 @@
+
+#include "tnyosc-queue.hpp"
+
+#include <algorithm>
+
+#include <time.h>
+
+using namespace tnyosc;
+
+static uint64_t monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// orders class ids by descending priority, then by id
+struct ComparePriority {
+  const std::vector<int>* priorities;
+  bool operator()(size_t a, size_t b) const {
+    if ((*priorities)[a] != (*priorities)[b]) {
+      return (*priorities)[a] > (*priorities)[b];
+    }
+    return a < b;
+  }
+};
+
+ReceiveQueue::ReceiveQueue()
+{
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+ReceiveQueue::~ReceiveQueue()
+{
+  pthread_mutex_destroy(&mutex_);
+}
+
+size_t ReceiveQueue::add_class(int priority, size_t capacity,
+    OverflowPolicy policy)
+{
+  pthread_mutex_lock(&mutex_);
+  Class c;
+  c.priority = priority;
+  c.capacity = capacity > 0 ? capacity : 1;
+  c.policy = policy;
+  c.front_seq = 0;
+  classes_.push_back(c);
+  size_t id = classes_.size() - 1;
+
+  std::vector<int> priorities;
+  for (size_t i = 0; i < classes_.size(); ++i) {
+    priorities.push_back(classes_[i].priority);
+  }
+  order_.push_back(id);
+  ComparePriority compare;
+  compare.priorities = &priorities;
+  std::sort(order_.begin(), order_.end(), compare);
+  pthread_mutex_unlock(&mutex_);
+  return id;
+}
+
+void ReceiveQueue::assign(size_t id, const char* pattern)
+{
+  pthread_mutex_lock(&mutex_);
+  if (id < classes_.size() && pattern != NULL) {
+    Route route;
+    route.pattern = pattern;
+    route.id = id;
+    routes_.push_back(route);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+size_t ReceiveQueue::find_class(const std::string& address) const
+{
+  for (size_t i = 0; i < routes_.size(); ++i) {
+    if (Dispatcher::pattern_match(address, routes_[i].pattern)) {
+      return routes_[i].id;
+    }
+  }
+  return 0;
+}
+
+void ReceiveQueue::pop_front(Class& c)
+{
+  if (c.policy == kLatestPerAddress) {
+    std::tr1::unordered_map<std::string, uint64_t>::iterator it =
+      c.latest.find(c.items.front().address);
+    if (it != c.latest.end() && it->second == c.front_seq) c.latest.erase(it);
+  }
+  c.items.pop_front();
+  ++c.front_seq;
+}
+
+void ReceiveQueue::enqueue(Class& c, const PacketElement& element,
+    const std::string& address, uint64_t now)
+{
+  if (c.policy == kLatestPerAddress) {
+    std::tr1::unordered_map<std::string, uint64_t>::iterator it =
+      c.latest.find(address);
+    if (it != c.latest.end()) {
+      // keep the queue position, so a busy address is not starved
+      Item& item = c.items[it->second - c.front_seq];
+      item.data.assign(element.data, element.data + element.size);
+      item.timetag = element.timetag;
+      ++c.stats.replaced;
+      return;
+    }
+  }
+
+  if (c.items.size() >= c.capacity) {
+    ++c.stats.dropped;
+    if (c.policy == kDropNewest) return;
+    pop_front(c);
+  }
+
+  if (c.policy == kLatestPerAddress) {
+    c.latest[address] = c.front_seq + c.items.size();
+  }
+  c.items.push_back(Item());
+  Item& item = c.items.back();
+  item.address = address;
+  item.data.assign(element.data, element.data + element.size);
+  item.timetag = element.timetag;
+  item.enqueue_ns = now;
+  ++c.stats.enqueued;
+}
+
+bool ReceiveQueue::push(const char* data, size_t size)
+{
+  uint64_t now = monotonic_ns();
+  pthread_mutex_lock(&mutex_);
+  elements_.clear();
+  bool ok = !classes_.empty() &&
+    Dispatcher::index_packet(data, size, elements_);
+  // check every address first so that a rejected packet queues nothing
+  for (size_t i = 0; ok && i < elements_.size(); ++i) {
+    ok = memchr(elements_[i].data, '\0', elements_[i].size) != NULL;
+  }
+  for (size_t i = 0; ok && i < elements_.size(); ++i) {
+    const PacketElement& element = elements_[i];
+    std::string address(element.data);
+    enqueue(classes_[find_class(address)], element, address, now);
+  }
+  pthread_mutex_unlock(&mutex_);
+  return ok;
+}
+
+size_t ReceiveQueue::dispatch(Dispatcher& dispatcher, size_t max_messages)
+{
+  size_t count = 0;
+  Item item;
+  while (count < max_messages) {
+    pthread_mutex_lock(&mutex_);
+    Class* c = NULL;
+    for (size_t i = 0; i < order_.size(); ++i) {
+      if (!classes_[order_[i]].items.empty()) {
+        c = &classes_[order_[i]];
+        break;
+      }
+    }
+    if (c == NULL) {
+      pthread_mutex_unlock(&mutex_);
+      break;
+    }
+    item.data.swap(c->items.front().data);
+    item.timetag = c->items.front().timetag;
+    uint64_t wait_ns = monotonic_ns() - c->items.front().enqueue_ns;
+    pop_front(*c);
+    ++c->stats.dispatched;
+    c->stats.total_wait_ns += wait_ns;
+    c->stats.max_wait_ns = std::max(c->stats.max_wait_ns, wait_ns);
+    pthread_mutex_unlock(&mutex_);
+
+    std::list<CallbackRef> callbacks =
+      dispatcher.match_methods(&item.data[0], item.data.size());
+    std::list<CallbackRef>::iterator it = callbacks.begin();
+    for (; it != callbacks.end(); ++it) {
+      // the message was queued without its bundle
+      (*it)->timetag = item.timetag;
+      dispatcher.invoke(*it);
+    }
+    ++count;
+  }
+  return count;
+}
+
+size_t ReceiveQueue::size() const
+{
+  pthread_mutex_lock(&mutex_);
+  size_t n = 0;
+  for (size_t i = 0; i < classes_.size(); ++i) n += classes_[i].items.size();
+  pthread_mutex_unlock(&mutex_);
+  return n;
+}
+
+QueueClassStats ReceiveQueue::class_stats(size_t id) const
+{
+  pthread_mutex_lock(&mutex_);
+  QueueClassStats stats;
+  if (id < classes_.size()) {
+    stats = classes_[id].stats;
+    stats.depth = classes_[id].items.size();
+  }
+  pthread_mutex_unlock(&mutex_);
+  return stats;
+}
@@ -0,0 +1,175 @@
+
+#include "tnyosc-router.hpp"
+
+#include <arpa/inet.h>
+
+using namespace tnyosc;
+
+// largest number of addresses remembered by find_subscribers
+static const size_t kMaxCachedAddresses = 4096;
+
+// bundle header with an immediate timetag
+static const char kBundleHeader[16] = {
+  '#', 'b', 'u', 'n', 'd', 'l', 'e', '\0', 0, 0, 0, 0, 0, 0, 0, 1
+};
+
+static void put_size(ByteArray& buffer, size_t offset, uint32_t size)
+{
+  uint32_t n = htonl(size);
+  memcpy(&buffer[offset], &n, 4);
+}
+
+Router::Router(size_t max_packet_size)
+  : max_packet_size_(max_packet_size)
+{
+}
+
+size_t Router::add_subscriber(packet_sink sink, void* user_data)
+{
+  Subscriber s;
+  s.sink = sink;
+  s.user_data = user_data;
+  s.num_elements = 0;
+  s.timed_offset = 0;
+  subscribers_.push_back(s);
+  return subscribers_.size() - 1;
+}
+
+void Router::subscribe(size_t subscriber, const char* pattern)
+{
+  if (subscriber >= subscribers_.size() || pattern == NULL) return;
+  subscribers_[subscriber].patterns.push_back(pattern);
+  matches_.clear();
+}
+
+bool Router::index_elements(const char* data, size_t size,
+    const char* timetag, std::vector<Element>& elements)
+{
+  if (size < 8 || memcmp(data, "#bundle\0", 8)) {
+    if (size == 0 || data[0] != '/' || memchr(data, '\0', size) == NULL) {
+      return false;
+    }
+    Element e;
+    e.data = data;
+    e.size = size;
+    e.timetag = timetag;
+    elements.push_back(e);
+    return true;
+  }
+
+  if (size < 16) return false;
+  const char* new_timetag = data + 8;
+  // an immediate timetag inside a timed bundle keeps the outer one
+  if (!memcmp(new_timetag, kBundleHeader + 8, 8)) new_timetag = timetag;
+  data += 16; size -= 16;
+  while (size != 0) {
+    uint32_t seg_size;
+    if (size < 4) return false;
+    memcpy(&seg_size, data, 4); data += 4; size -= 4;
+    seg_size = ntohl(seg_size);
+    if (seg_size > size) return false;
+    if (!index_elements(data, seg_size, new_timetag, elements)) return false;
+    data += seg_size; size -= seg_size;
+  }
+  return true;
+}
+
+const std::vector<uint32_t>& Router::find_subscribers(const char* address)
+{
+  std::string key(address);
+  std::tr1::unordered_map<std::string, std::vector<uint32_t> >::iterator it =
+    matches_.find(key);
+  if (it != matches_.end()) return it->second;
+
+  if (matches_.size() >= kMaxCachedAddresses) matches_.clear();
+  std::vector<uint32_t>& ids = matches_[key];
+  for (size_t i = 0; i < subscribers_.size(); ++i) {
+    const std::vector<std::string>& patterns = subscribers_[i].patterns;
+    for (size_t j = 0; j < patterns.size(); ++j) {
+      if (Dispatcher::pattern_match(key, patterns[j])) {
+        ids.push_back(i);
+        break;
+      }
+    }
+  }
+  return ids;
+}
+
+bool Router::route(const char* data, size_t size)
+{
+  ++stats_.packets;
+  elements_.clear();
+  if (!index_elements(data, size, NULL, elements_)) {
+    ++stats_.malformed;
+    return false;
+  }
+  stats_.messages += elements_.size();
+
+  for (size_t i = 0; i < elements_.size(); ++i) {
+    const std::vector<uint32_t>& ids = find_subscribers(elements_[i].data);
+    for (size_t j = 0; j < ids.size(); ++j) {
+      queue(subscribers_[ids[j]], elements_[i]);
+      ++stats_.forwarded;
+    }
+  }
+  return true;
+}
+
+void Router::queue(Subscriber& s, const Element& e)
+{
+  bool same_timetag = s.timed_offset != 0 && e.timetag != NULL &&
+    !memcmp(&s.buffer[s.timed_offset + 12], e.timetag, 8);
+  // bytes added: the element, plus a sub-bundle header unless one is open
+  size_t needed = 4 + e.size;
+  if (e.timetag != NULL && !same_timetag) needed += 4 + 16;
+  size_t current = s.buffer.empty() ? 16 : s.buffer.size();
+  if (current + needed > max_packet_size_ && s.num_elements > 0) {
+    send(s);
+    same_timetag = false;
+  }
+
+  if (s.buffer.empty()) {
+    s.buffer.assign(kBundleHeader, kBundleHeader + 16);
+  }
+  if (e.timetag == NULL) {
+    s.timed_offset = 0;
+  } else if (!same_timetag) {
+    // open a sub-bundle carrying the original timetag
+    s.timed_offset = s.buffer.size();
+    s.buffer.resize(s.timed_offset + 4);
+    s.buffer.insert(s.buffer.end(), kBundleHeader, kBundleHeader + 8);
+    s.buffer.insert(s.buffer.end(), e.timetag, e.timetag + 8);
+    ++s.num_elements;
+  }
+
+  size_t offset = s.buffer.size();
+  s.buffer.resize(offset + 4);
+  put_size(s.buffer, offset, e.size);
+  s.buffer.insert(s.buffer.end(), e.data, e.data + e.size);
+  if (s.timed_offset != 0) {
+    put_size(s.buffer, s.timed_offset,
+        s.buffer.size() - s.timed_offset - 4);
+  } else {
+    ++s.num_elements;
+  }
+}
+
+void Router::send(Subscriber& s)
+{
+  if (s.num_elements == 0) return;
+  if (s.num_elements == 1) {
+    // a lone message or sub-bundle goes out without the outer bundle
+    s.sink(&s.buffer[16 + 4], s.buffer.size() - 16 - 4, s.user_data);
+  } else {
+    s.sink(&s.buffer[0], s.buffer.size(), s.user_data);
+  }
+  ++stats_.sent;
+  s.buffer.clear();
+  s.num_elements = 0;
+  s.timed_offset = 0;
+}
+
+void Router::flush()
+{
+  for (size_t i = 0; i < subscribers_.size(); ++i) send(subscribers_[i]);
+}
@@ -0,0 +1,196 @@
+
+#include "tnyosc-server.hpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#if defined(__linux__)
+#include <sched.h> // cpu_set_t
+#endif
+
+using namespace tnyosc;
+
+// how often a receive thread checks whether it should stop, in milliseconds
+static const int kPollInterval = 100;
+
+// largest possible UDP payload
+static const size_t kMaxPacketSize = 65536;
+
+ShardedServer::ShardedServer()
+  : port_(0), pin_threads_(false), stop_(0)
+{
+}
+
+ShardedServer::~ShardedServer()
+{
+  stop();
+}
+
+void ShardedServer::add_method(const char* address, const char* types,
+    osc_method method, void* user_data)
+{
+  MethodTemplate m;
+  m.address = address == NULL ? "" : address;
+  m.types = types == NULL ? "" : types;
+  m.user_data = user_data;
+  m.method = method;
+  methods_.push_back(m);
+}
+
+int ShardedServer::open_socket(uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return -1;
+
+  int on = 1;
+#ifdef SO_REUSEPORT
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+    close(fd);
+    return -1;
+  }
+#endif
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool ShardedServer::start(uint16_t port, size_t num_shards, bool pin_threads)
+{
+  if (!shards_.empty() || num_shards == 0) return false;
+#ifndef SO_REUSEPORT
+  if (num_shards > 1) return false;
+#endif
+  __sync_lock_test_and_set(&stop_, 0);
+  pin_threads_ = pin_threads;
+
+  // open every socket before starting threads, so a failure leaves nothing
+  // running; the first socket decides the port when port is 0
+  for (size_t i = 0; i < num_shards; ++i) {
+    int fd = open_socket(port);
+    if (fd < 0) {
+      for (size_t j = 0; j < shards_.size(); ++j) {
+        close(shards_[j]->fd);
+        delete shards_[j];
+      }
+      shards_.clear();
+      return false;
+    }
+    if (port == 0) {
+      struct sockaddr_in addr;
+      socklen_t len = sizeof(addr);
+      getsockname(fd, (struct sockaddr*)&addr, &len);
+      port = ntohs(addr.sin_port);
+    }
+
+    Shard* shard = new Shard();
+    shard->server = this;
+    shard->index = i;
+    shard->fd = fd;
+    for (size_t j = 0; j < methods_.size(); ++j) {
+      shard->dispatcher.add_method(methods_[j].address.c_str(),
+          methods_[j].types.c_str(), methods_[j].method,
+          methods_[j].user_data);
+    }
+    shards_.push_back(shard);
+  }
+  port_ = port;
+
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    if (pthread_create(&shards_[i]->thread, NULL, &ShardedServer::shard_main,
+          shards_[i]) != 0) {
+      // close the shards without a thread, then join the threads that were
+      // started
+      for (size_t j = i; j < shards_.size(); ++j) {
+        close(shards_[j]->fd);
+        delete shards_[j];
+      }
+      shards_.resize(i);
+      stop();
+      return false;
+    }
+  }
+  return true;
+}
+
+void ShardedServer::stop()
+{
+  __sync_lock_test_and_set(&stop_, 1);
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    pthread_join(shards_[i]->thread, NULL);
+  }
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    close(shards_[i]->fd);
+    delete shards_[i];
+  }
+  shards_.clear();
+  port_ = 0;
+}
+
+ShardStats ShardedServer::shard_stats(size_t shard) const
+{
+  ShardStats stats;
+  if (shard >= shards_.size()) return stats;
+  ShardStats& s = shards_[shard]->stats;
+  stats.packets = __sync_fetch_and_add(&s.packets, 0);
+  stats.bytes = __sync_fetch_and_add(&s.bytes, 0);
+  stats.callbacks = __sync_fetch_and_add(&s.callbacks, 0);
+  stats.unmatched = __sync_fetch_and_add(&s.unmatched, 0);
+  return stats;
+}
+
+void* ShardedServer::shard_main(void* arg)
+{
+  Shard* shard = (Shard*)arg;
+  ShardedServer* server = shard->server;
+
+#if defined(__linux__)
+  if (server->pin_threads_) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus > 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(shard->index % num_cpus, &cpus);
+      pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+  }
+#endif
+
+  std::vector<char> buffer(kMaxPacketSize);
+  struct pollfd pfd;
+  pfd.fd = shard->fd;
+  pfd.events = POLLIN;
+  while (!__sync_fetch_and_add(&server->stop_, 0)) {
+    int ready = poll(&pfd, 1, kPollInterval);
+    if (ready <= 0) continue;
+
+    ssize_t size = recv(shard->fd, &buffer[0], buffer.size(), 0);
+    if (size <= 0) continue;
+    __sync_fetch_and_add(&shard->stats.packets, 1);
+    __sync_fetch_and_add(&shard->stats.bytes, size);
+
+    std::list<CallbackRef> callback_list = 
+      shard->dispatcher.match_methods(&buffer[0], size);
+    if (callback_list.empty()) {
+      __sync_fetch_and_add(&shard->stats.unmatched, 1);
+      continue;
+    }
+    std::list<CallbackRef>::iterator it = callback_list.begin();
+    for (; it != callback_list.end(); ++it) {
+      shard->dispatcher.invoke(*it);
+    }
+    __sync_fetch_and_add(&shard->stats.callbacks, callback_list.size());
+  }
+  return NULL;
+}
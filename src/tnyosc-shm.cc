@@ -0,0 +1,288 @@
+
+#include "tnyosc-shm.hpp"
+#include "tnyosc-audit.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace tnyosc;
+
+static const uint32_t kShmMagic = 0x4f534352; // "OSCR"
+static const uint32_t kShmVersion = 1;
+
+// record states; 0 means the record is not yet written
+static const uint32_t kRecordPacket = 1;
+static const uint32_t kRecordPadding = 2; // unused space up to the ring end
+
+namespace tnyosc {
+
+// Shared state at the start of the mapping. The write and read positions
+// count bytes since creation and live on separate cache lines.
+struct ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity; // power of two
+  char pad0[48];
+  volatile uint64_t reserve; // next byte to reserve, advanced by writers
+  char pad1[56];
+  volatile uint64_t read; // next byte to read, advanced by the reader
+  volatile uint32_t waiting; // nonzero while the reader sleeps
+  volatile uint32_t wakeups; // futex word, bumped to wake the reader
+  char pad2[48];
+};
+
+} // namespace tnyosc
+
+struct RecordHeader {
+  uint32_t size; // packet size, or record size for padding
+  volatile uint32_t state;
+};
+
+static size_t record_size(size_t size)
+{
+  return sizeof(RecordHeader) + ((size + 7) & ~(size_t)7);
+}
+
+static void futex_wait(volatile uint32_t* word, uint32_t value,
+    int timeout_ms)
+{
+#ifdef __linux__
+  struct timespec ts;
+  struct timespec* pts = NULL;
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    pts = &ts;
+  }
+  syscall(SYS_futex, word, FUTEX_WAIT, value, pts, NULL, 0);
+#else
+  // no process-shared futex; poll instead
+  int slept = 0;
+  while (*word == value && (timeout_ms < 0 || slept < timeout_ms)) {
+    usleep(1000);
+    ++slept;
+  }
+#endif
+}
+
+static void futex_wake(volatile uint32_t* word)
+{
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+  (void)word;
+#endif
+}
+
+ShmRing::ShmRing()
+  : header_(NULL), data_(NULL), map_size_(0), peek_size_(0)
+{
+}
+
+ShmRing::~ShmRing()
+{
+  close();
+}
+
+bool ShmRing::map(int fd, size_t size)
+{
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return false;
+  header_ = (ShmRingHeader*)p;
+  data_ = (char*)p + sizeof(ShmRingHeader);
+  map_size_ = size;
+  peek_size_ = 0;
+  return true;
+}
+
+bool ShmRing::create(const char* name, size_t capacity)
+{
+  close();
+  size_t n = 64;
+  while (n < capacity) n <<= 1;
+  size_t size = sizeof(ShmRingHeader) + n;
+
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) return false;
+  if (ftruncate(fd, size) != 0) {
+    ::close(fd);
+    shm_unlink(name);
+    return false;
+  }
+  if (!map(fd, size)) {
+    shm_unlink(name);
+    return false;
+  }
+
+  // ftruncate zero-fills, so all records start unwritten
+  header_->version = kShmVersion;
+  header_->capacity = n;
+  header_->reserve = 0;
+  header_->read = 0;
+  header_->waiting = 0;
+  header_->wakeups = 0;
+  __sync_synchronize();
+  header_->magic = kShmMagic;
+  return true;
+}
+
+bool ShmRing::open(const char* name)
+{
+  close();
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+    ::close(fd);
+    return false;
+  }
+  if (!map(fd, st.st_size)) return false;
+  if (header_->magic != kShmMagic || header_->version != kShmVersion ||
+      sizeof(ShmRingHeader) + header_->capacity > map_size_) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void ShmRing::close()
+{
+  if (header_ == NULL) return;
+  munmap(header_, map_size_);
+  header_ = NULL;
+  data_ = NULL;
+  map_size_ = 0;
+  peek_size_ = 0;
+}
+
+bool ShmRing::unlink(const char* name)
+{
+  return shm_unlink(name) == 0;
+}
+
+size_t ShmRing::capacity() const
+{
+  return header_ ? header_->capacity : 0;
+}
+
+char* ShmRing::reserve(size_t size)
+{
+  TNYOSC_AUDIT_SCOPE("ShmRing::reserve");
+  if (header_ == NULL) return NULL;
+  uint64_t capacity = header_->capacity;
+  uint64_t need = record_size(size);
+  if (size > 0xffffffffu || need > capacity) return NULL;
+
+  uint64_t pos, total, offset;
+  for (;;) {
+    pos = header_->reserve;
+    offset = pos & (capacity - 1);
+    // a record never wraps; skip to the ring start with a padding record
+    total = need;
+    if (offset + need > capacity) total += capacity - offset;
+    if (pos + total - header_->read > capacity) return NULL;
+    if (__sync_bool_compare_and_swap(&header_->reserve, pos, pos + total)) {
+      break;
+    }
+  }
+
+  if (total != need) {
+    RecordHeader* padding = (RecordHeader*)(data_ + offset);
+    padding->size = capacity - offset;
+    __sync_synchronize();
+    padding->state = kRecordPadding;
+    offset = 0;
+  }
+  RecordHeader* record = (RecordHeader*)(data_ + offset);
+  record->size = size;
+  return (char*)(record + 1);
+}
+
+void ShmRing::commit(char* packet)
+{
+  RecordHeader* record = (RecordHeader*)packet - 1;
+  __sync_synchronize();
+  record->state = kRecordPacket;
+  __sync_synchronize();
+  if (header_->waiting) {
+    __sync_fetch_and_add(&header_->wakeups, 1);
+    futex_wake(&header_->wakeups);
+  }
+}
+
+const char* ShmRing::peek(size_t* size)
+{
+  if (header_ == NULL) return NULL;
+  uint64_t capacity = header_->capacity;
+  for (;;) {
+    uint64_t pos = header_->read;
+    RecordHeader* record = (RecordHeader*)(data_ + (pos & (capacity - 1)));
+    uint32_t state = record->state;
+    __sync_synchronize();
+    if (state == kRecordPadding) {
+      // records are cleared once read, so a stale header from an earlier
+      // lap never looks written
+      uint32_t n = record->size;
+      memset(record, 0, n);
+      __sync_synchronize();
+      header_->read = pos + n;
+      continue;
+    }
+    if (state != kRecordPacket) return NULL;
+    peek_size_ = record_size(record->size);
+    if (size) *size = record->size;
+    return (const char*)(record + 1);
+  }
+}
+
+void ShmRing::release()
+{
+  if (header_ == NULL || peek_size_ == 0) return;
+  uint64_t pos = header_->read;
+  memset(data_ + (pos & (header_->capacity - 1)), 0, peek_size_);
+  __sync_synchronize();
+  header_->read = pos + peek_size_;
+  peek_size_ = 0;
+}
+
+bool ShmRing::wait(int timeout_ms)
+{
+  if (header_ == NULL) return false;
+  if (peek(NULL)) return true;
+  uint32_t wakeups = header_->wakeups;
+  header_->waiting = 1;
+  __sync_synchronize();
+  // a writer that committed before waiting was set is seen here; any later
+  // writer bumps wakeups, so the futex wait returns at once
+  if (peek(NULL) == NULL) {
+    futex_wait(&header_->wakeups, wakeups, timeout_ms);
+  }
+  header_->waiting = 0;
+  return peek(NULL) != NULL;
+}
+
+size_t ShmRing::dispatch(Dispatcher& dispatcher, size_t max_packets)
+{
+  size_t count = 0;
+  size_t size;
+  const char* packet;
+  while (count < max_packets && (packet = peek(&size)) != NULL) {
+    std::list<CallbackRef> callbacks = dispatcher.match_methods(packet, size);
+    release();
+    std::list<CallbackRef>::iterator it = callbacks.begin();
+    for (; it != callbacks.end(); ++it) dispatcher.invoke(*it);
+    ++count;
+  }
+  return count;
+}
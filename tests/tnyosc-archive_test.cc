@@ -0,0 +1,84 @@
+
+#include "tnyosc-archive.hpp"
+#include "tnyosc.hpp"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+static void remove_archive(const std::string& base)
+{
+  const char* ext[] = {".dat", ".idx", ".adr", ".ckp", ".blk"};
+  for (int i = 0; i < 5; i++) unlink((base + ext[i]).c_str());
+}
+
+TEST(ArchiveQuery)
+{
+  using namespace tnyosc;
+  char base[64];
+  snprintf(base, sizeof(base), "/tmp/tnyosc-archive-%d", (int)getpid());
+  remove_archive(base);
+
+  // one message per second from t0, alternating between two faders
+  uint64_t t0 = get_current_ntp_time();
+  const uint64_t second = 1ULL << 32;
+  ArchiveWriter writer;
+  CHECK(writer.open(base));
+  for (int i = 0; i < 3000; i++) {
+    // one rare address, in the second checkpoint block only
+    Message msg(i == 1500 ? "/fader/9" : i % 2 ? "/fader/2" : "/fader/1");
+    msg.append(i);
+    CHECK(writer.append(msg.data(), msg.size(), t0 + i * second));
+  }
+  writer.close();
+
+  // reopening appends; the bundle timetag overrides the receive time
+  CHECK(writer.open(base));
+  Bundle bundle;
+  bundle.set_timetag(t0 + 5000 * second);
+  Message cue("/cue/go");
+  cue.append(42);
+  bundle.append(cue);
+  bundle.append(cue);
+  CHECK(writer.append(bundle.data(), bundle.size(), t0));
+  CHECK(!writer.append("#bundle", 8, t0));
+  writer.close();
+
+  ArchiveReader reader;
+  CHECK(reader.open(base));
+  CHECK(reader.size() == 3002);
+  CHECK(reader.addresses().size() == 4);
+
+  std::vector<ArchiveRecord> records;
+  CHECK(reader.query("/fader/1", t0 + 100 * second, t0 + 109 * second,
+        records) == 5);
+  CHECK(records[0].time == t0 + 100 * second);
+
+  MessageReader msg;
+  CHECK(msg.parse(records[4].data, records[4].size));
+  int32_t value;
+  CHECK(msg.read_int32s(0, &value, 1) == 1);
+  CHECK(value == 108);
+
+  records.clear();
+  CHECK(reader.query("/fader/*", t0, t0 + 10000 * second, records) == 3000);
+  records.clear();
+  CHECK(reader.query("/cue/*", t0 + 4000 * second, t0 + 6000 * second,
+        records) == 2);
+  CHECK(strcmp(records[0].address, "/cue/go") == 0);
+  CHECK(records[1].size == cue.size());
+  records.clear();
+  CHECK(reader.query("/fader/9", t0, t0 + 10000 * second, records) == 1);
+  CHECK(records[0].time == t0 + 1500 * second);
+  records.clear();
+  CHECK(reader.query("/none", t0, t0 + 10000 * second, records) == 0);
+
+  reader.close();
+  remove_archive(base);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
@@ -0,0 +1,107 @@
+
+#include "tnyosc-assembler.hpp"
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <list>
+#include <vector>
+
+#include <pthread.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+const int NUM_PRODUCERS = 4;
+const int NUM_MESSAGES = 20000;
+
+struct Producer {
+  tnyosc::BundleAssembler* assembler;
+  int id;
+  int sent;
+};
+
+void* producer_main(void* arg)
+{
+  Producer* p = (Producer*)arg;
+  p->sent = 0;
+  for (int i = 0; i < NUM_MESSAGES; ++i) {
+    tnyosc::Message msg("/producer");
+    msg.append(p->id);
+    msg.append(i);
+    // retry until the flusher makes room
+    while (!p->assembler->append(msg)) sched_yield();
+    ++p->sent;
+  }
+  return NULL;
+}
+
+TEST(BundleAssemblerSingleThread)
+{
+  using namespace tnyosc;
+  BundleAssembler assembler(16 + 3 * 20);
+  Message msg("/a");
+  msg.append(1);
+  msg.append(2);
+  CHECK(msg.size() == 16);
+  size_t size = 0;
+  CHECK(assembler.flush(1, &size) == NULL && size == 0);
+
+  CHECK(assembler.append(msg));
+  CHECK(assembler.append(msg));
+  CHECK(assembler.append(msg));
+  CHECK(assembler.append(msg) == false); // full
+  const char* bundle = assembler.flush(5ULL << 32, &size);
+  CHECK(bundle != NULL && size == 16 + 3 * 20);
+
+  std::list<ParsedMessage> messages;
+  CHECK(Dispatcher::decode_data(bundle, size, messages));
+  CHECK(messages.size() == 3);
+
+  // in-place encoding, and the new buffer starts empty
+  char* p = assembler.reserve(msg.size());
+  CHECK(p != NULL);
+  memcpy(p, msg.data(), msg.size());
+  assembler.commit(p);
+  bundle = assembler.flush(5ULL << 32, &size);
+  CHECK(size == 16 + 20);
+  CHECK(assembler.reserve(3) == NULL);
+}
+
+TEST(BundleAssemblerProducers)
+{
+  using namespace tnyosc;
+  BundleAssembler assembler(1472);
+  Producer producers[NUM_PRODUCERS];
+  pthread_t threads[NUM_PRODUCERS];
+  for (int i = 0; i < NUM_PRODUCERS; ++i) {
+    producers[i].assembler = &assembler;
+    producers[i].id = i;
+    pthread_create(&threads[i], NULL, &producer_main, &producers[i]);
+  }
+
+  // flush continuously and check per-producer order
+  std::vector<int> next(NUM_PRODUCERS, 0);
+  bool in_order = true;
+  int received = 0;
+  while (received < NUM_PRODUCERS * NUM_MESSAGES) {
+    size_t size = 0;
+    const char* bundle = assembler.flush(1, &size);
+    if (bundle == NULL) continue;
+    std::list<ParsedMessage> messages;
+    CHECK(Dispatcher::decode_data(bundle, size, messages));
+    std::list<ParsedMessage>::iterator it = messages.begin();
+    for (; it != messages.end(); ++it) {
+      int id = it->argv[0].data.i;
+      if (it->argv[1].data.i != next[id]) in_order = false;
+      next[id] = it->argv[1].data.i + 1;
+      ++received;
+    }
+  }
+  for (int i = 0; i < NUM_PRODUCERS; ++i) pthread_join(threads[i], NULL);
+  CHECK(in_order);
+  CHECK(received == NUM_PRODUCERS * NUM_MESSAGES);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
@@ -0,0 +1,71 @@
+
+// Build with -DTNYOSC_RT_AUDIT=1 and link tnyosc-audit.cc. Checks that the
+// APIs meant for realtime threads neither allocate nor lock.
+#include "tnyosc-audit.hpp"
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <iostream>
+
+#include <UnitTest++/UnitTest++.h>
+
+static void check_budget(const char* scope)
+{
+  tnyosc::AuditCounts counts = tnyosc::audit_counts(scope);
+  std::cerr << scope << ": " << counts.calls << " calls, " 
+    << counts.allocations << " allocations, " << counts.frees << " frees, " 
+    << counts.locks << " locks\n";
+  CHECK(counts.calls > 0);
+  CHECK(counts.allocations == 0);
+  CHECK(counts.frees == 0);
+  CHECK(counts.locks == 0);
+}
+
+TEST(RealtimeApisDoNotAllocate)
+{
+  using namespace tnyosc;
+  float frame[512];
+  for (int i = 0; i < 512; i++) frame[i] = (float)i;
+  Message msg("/meters");
+  msg.append_floats(frame, 512);
+  Message array_msg("/meters");
+  array_msg.append_array(frame, 512);
+
+  std::list<ParsedMessage> messages;
+  CHECK(Dispatcher::decode_data(array_msg.data(), array_msg.size(), 
+        messages));
+  ArrayView view;
+  CHECK(view.assign(messages.front().argv, 0));
+
+  audit_reset();
+  float out[512];
+  MessageReader reader;
+  for (int i = 0; i < 100; i++) {
+    CHECK(reader.parse(msg.data(), msg.size()));
+    CHECK(reader.read_floats(0, out, 512) == 512);
+    CHECK(view.copy_to(out, 512) == 512);
+  }
+
+  check_budget("MessageReader::parse");
+  check_budget("MessageReader::read");
+  check_budget("ArrayView::copy_to");
+}
+
+TEST(DecodeAllocationsAreCounted)
+{
+  using namespace tnyosc;
+  Message msg("/test");
+  msg.append("allocates");
+
+  audit_reset();
+  std::list<ParsedMessage> messages;
+  CHECK(Dispatcher::decode_data(msg.data(), msg.size(), messages));
+  AuditCounts counts = audit_counts("Dispatcher::decode_data");
+  CHECK(counts.calls == 1);
+  CHECK(counts.allocations > 0);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
@@ -0,0 +1,90 @@
+
+#include "tnyosc-block.hpp"
+#include "tnyosc-audit.hpp"
+#include "tnyosc-dispatch.hpp"
+
+#include <UnitTest++/UnitTest++.h>
+
+const double SAMPLE_RATE = 48000.0;
+const uint32_t FRAMES = 64;
+// 2020-01-01 in NTP seconds
+const uint64_t START_SEC = 3786825600ULL;
+
+static tnyosc::CallbackRef make_event(uint64_t sec, uint32_t usec, int id)
+{
+  tnyosc::CallbackRef callback(new tnyosc::Callback());
+  callback->timetag.tv_sec = sec ? sec - 2208988800ULL : 0;
+  callback->timetag.tv_usec = usec;
+  callback->argv.resize(1);
+  callback->argv[0].type = 'i';
+  callback->argv[0].data.i = id;
+  return callback;
+}
+
+TEST(BlockSchedulerOffsets)
+{
+  using namespace tnyosc;
+  BlockScheduler scheduler(8, 4);
+  // 1000 us = 48 frames into the first block, 2000 us = 96 frames, i.e.
+  // frame 32 of the second block
+  CHECK(scheduler.post(make_event(START_SEC, 2000, 2)));
+  CHECK(scheduler.post(make_event(START_SEC, 1000, 1)));
+  CHECK(scheduler.post(make_event(0, 0, 0))); // immediate
+  CHECK(scheduler.post(make_event(START_SEC - 1, 0, -1))); // late
+
+  BlockEvent events[8];
+  uint64_t start = START_SEC << 32;
+  uint64_t block = (uint64_t)(FRAMES * 4294967296.0 / SAMPLE_RATE);
+  size_t n = scheduler.process(start, SAMPLE_RATE, FRAMES, events, 8);
+  CHECK(n == 3);
+  CHECK(events[0].callback->argv[0].data.i == 0);
+  CHECK(events[0].offset == 0);
+  CHECK(events[1].callback->argv[0].data.i == -1);
+  CHECK(events[1].offset == 0);
+  CHECK(events[2].callback->argv[0].data.i == 1);
+  CHECK(events[2].offset == 47 || events[2].offset == 48);
+
+  n = scheduler.process(start + block, SAMPLE_RATE, FRAMES, events, 8);
+  CHECK(n == 1);
+  CHECK(events[0].callback->argv[0].data.i == 2);
+  CHECK(events[0].offset == 31 || events[0].offset == 32);
+
+  n = scheduler.process(start + 2 * block, SAMPLE_RATE, FRAMES, events, 8);
+  CHECK(n == 0);
+
+  // every callback has been retired, so the capacity is free again
+  for (int i = 0; i < 8; ++i) {
+    CHECK(scheduler.post(make_event(START_SEC + 10, 0, i)));
+  }
+  CHECK(scheduler.post(make_event(START_SEC + 10, 0, 8)) == false);
+
+  // at most max_block_events per block
+  n = scheduler.process((START_SEC + 10) << 32, SAMPLE_RATE, FRAMES, events, 8);
+  CHECK(n == 4);
+  CHECK(events[3].callback->argv[0].data.i == 3);
+}
+
+#if TNYOSC_RT_AUDIT
+TEST(BlockSchedulerDoesNotAllocate)
+{
+  using namespace tnyosc;
+  BlockScheduler scheduler(64, 64);
+  BlockEvent events[64];
+  for (int i = 0; i < 32; ++i) scheduler.post(make_event(START_SEC, i, i));
+  audit_reset();
+  uint64_t start = START_SEC << 32;
+  for (int i = 0; i < 4; ++i) {
+    scheduler.process(start + i * (1ULL << 24), SAMPLE_RATE, FRAMES,
+        events, 64);
+  }
+  CHECK(audit_counts("BlockScheduler::process").calls == 4);
+  CHECK(audit_counts("BlockScheduler::process").allocations == 0);
+  CHECK(audit_counts("BlockScheduler::process").frees == 0);
+  CHECK(audit_counts("BlockScheduler::process").locks == 0);
+}
+#endif // TNYOSC_RT_AUDIT
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
@@ -0,0 +1,86 @@
+
+// Build with -std=c++20.
+#include "tnyosc-coro.hpp"
+#include "tnyosc.hpp"
+
+#include <iostream>
+#include <stdio.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+const int NUM_CUES = 1000;
+
+struct CueState {
+  int done;
+  int timed_out;
+  int total;
+};
+
+tnyosc::Task wait_cue(tnyosc::EventLoop& osc, int cue, CueState& state)
+{
+  char address[32];
+  snprintf(address, sizeof(address), "/cue/%d/done", cue);
+  tnyosc::Received r = co_await osc.next(address);
+  CHECK(!r.timed_out);
+  state.total += r.argv[0].data.i;
+  // wait a second time on the wildcard; every waiter gets its own copy
+  r = co_await osc.next("/cue/*/go");
+  state.done++;
+}
+
+tnyosc::Task wait_timeout(tnyosc::EventLoop& osc, CueState& state)
+{
+  tnyosc::Received r = co_await osc.next("/never", 20);
+  CHECK(r.timed_out);
+  state.timed_out++;
+}
+
+TEST(AwaitMessages)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+  socklen_t len = sizeof(addr);
+  getsockname(fd, (struct sockaddr*)&addr, &len);
+
+  tnyosc::EventLoop osc(fd);
+  CueState state = {0, 0, 0};
+  for (int i = 0; i < NUM_CUES; i++) wait_cue(osc, i, state);
+  wait_timeout(osc, state);
+  CHECK(osc.num_waiters() == NUM_CUES + 1);
+
+  int sender = socket(AF_INET, SOCK_DGRAM, 0);
+  for (int i = 0; i < NUM_CUES; i++) {
+    char address[32];
+    snprintf(address, sizeof(address), "/cue/%d/done", i);
+    tnyosc::Message msg(address);
+    msg.append(1);
+    sendto(sender, msg.data(), msg.size(), 0, 
+        (struct sockaddr*)&addr, sizeof(addr));
+    osc.run_once(1000);
+  }
+  CHECK(state.total == NUM_CUES);
+  while (state.timed_out == 0) osc.run_once(1000);
+  CHECK(osc.num_waiters() == NUM_CUES);
+
+  tnyosc::Message go("/cue/1/go");
+  sendto(sender, go.data(), go.size(), 0, 
+      (struct sockaddr*)&addr, sizeof(addr));
+  osc.run_once(1000);
+  CHECK(state.done == NUM_CUES);
+  CHECK(osc.num_waiters() == 0);
+
+  close(sender);
+  close(fd);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
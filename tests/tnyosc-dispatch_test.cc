@@ -1,8 +1,12 @@
 #include "tnyosc-dispatch.hpp"
+#include "tnyosc-pool.hpp"
 #include "tnyosc.hpp"
 
 #include <iostream>
 #include <assert.h>
+#if __cplusplus >= 201103L
+#include <type_traits>
+#endif
 
 #include <UnitTest++/UnitTest++.h>
 
@@ -49,6 +53,392 @@ TEST(CallMethodTestMessage)
   }
 }
 
+TEST(TimetagByteOrder)
+{
+  using namespace tnyosc;
+  // 3900000000.5 seconds since 1900
+  uint64_t ntp_time = (3900000000ULL << 32) | 0x80000000ULL;
+  Message msg("/time");
+  msg.append_time(ntp_time);
+  Bundle bundle;
+  bundle.set_timetag(ntp_time);
+  bundle.append(msg);
+
+  // big-endian seconds first, then the fraction
+  const unsigned char* tag = (const unsigned char*)bundle.data() + 8;
+  CHECK(tag[0] == 0xe8 && tag[1] == 0x75 && tag[2] == 0x47 && tag[3] == 0x00);
+  CHECK(tag[4] == 0x80 && tag[5] == 0x00 && tag[6] == 0x00 && tag[7] == 0x00);
+
+  std::list<ParsedMessage> messages;
+  CHECK(Dispatcher::decode_data(bundle.data(), bundle.size(), messages));
+  CHECK(messages.size() == 1);
+  CHECK(messages.front().timetag.tv_sec == 3900000000L - 2208988800L);
+  CHECK(messages.front().timetag.tv_usec >= 499999 &&
+      messages.front().timetag.tv_usec <= 500000);
+  CHECK(messages.front().argv.size() == 1);
+  CHECK(messages.front().argv[0].data.t == ntp_time);
+}
+
+void count_method(const std::string& address, 
+    const std::vector<tnyosc::Argument>& argv, 
+    void* user_data)
+{
+  *(int*)user_data += argv[0].data.i;
+}
+
+TEST(ParallelMatchNestedBundle)
+{
+  using namespace tnyosc;
+  // 64 sub-bundles of 50 messages, each sub-bundle with its own timetag
+  uint64_t now = get_current_ntp_time();
+  Bundle snapshot;
+  for (int i = 0; i < 64; i++) {
+    Bundle cue;
+    cue.set_timetag(now - ((uint64_t)i << 32));
+    for (int j = 0; j < 50; j++) {
+      Message msg(j % 2 ? "/cue/level" : "/cue/mute");
+      msg.append(i);
+      cue.append(msg);
+    }
+    snapshot.append(cue);
+  }
+
+  std::vector<PacketElement> elements;
+  CHECK(Dispatcher::index_packet(snapshot.data(), snapshot.size(), elements));
+  CHECK(elements.size() == 64 * 50);
+
+  int total = 0;
+  Dispatcher dispatcher;
+  dispatcher.add_method("/cue/level", "i", &count_method, &total);
+  WorkerPool pool(3);
+  std::list<CallbackRef> parallel = 
+    dispatcher.match_methods_parallel(snapshot.data(), snapshot.size(), pool);
+  std::list<CallbackRef> serial = 
+    dispatcher.match_methods(snapshot.data(), snapshot.size());
+  CHECK(parallel.size() == 64 * 25);
+  CHECK(parallel.size() == serial.size());
+
+  // oldest timetag first: the last sub-bundle
+  CHECK(parallel.front()->argv[0].data.i == 63);
+  std::list<CallbackRef>::iterator p = parallel.begin();
+  std::list<CallbackRef>::iterator s = serial.begin();
+  for (; p != parallel.end(); ++p, ++s) {
+    CHECK((*p)->timetag.tv_sec == (*s)->timetag.tv_sec);
+    dispatcher.invoke(*p);
+  }
+  CHECK(total == 25 * (63 * 64 / 2));
+
+  // a truncated element fails the whole packet
+  std::vector<char> broken(snapshot.data(), snapshot.data() + snapshot.size());
+  broken[16 + 4 + 16 + 3] = 0x7f;
+  CHECK(dispatcher.match_methods_parallel(&broken[0], broken.size(),
+        pool).empty());
+
+  // an empty bundle is valid and matches nothing
+  Bundle empty;
+  CHECK(dispatcher.match_methods_parallel(empty.data(), empty.size(),
+        pool).empty());
+}
+
+TEST(MatchCacheInvalidation)
+{
+  using namespace tnyosc;
+  int total = 0;
+  Message msg("/mixer/ch/1/level");
+  msg.append(1);
+
+  Dispatcher dispatcher;
+  dispatcher.add_method("/mixer/ch/*/level", NULL, &count_method, &total);
+  CHECK(dispatcher.match_methods(msg.data(), msg.size()).size() == 1);
+  CHECK(dispatcher.match_methods(msg.data(), msg.size()).size() == 1);
+  CHECK(dispatcher.cache_stats().misses == 1);
+  CHECK(dispatcher.cache_stats().hits == 1);
+
+  // a new method must be seen by addresses that are already cached
+  dispatcher.add_method("/mixer/ch/1/*", "i", &count_method, &total);
+  CHECK(dispatcher.match_methods(msg.data(), msg.size()).size() == 2);
+  CHECK(dispatcher.cache_stats().misses == 2);
+
+  // a cached method with a type filter still checks the types
+  Message other("/mixer/ch/1/level");
+  other.append(1.0f);
+  CHECK(dispatcher.match_methods(other.data(), other.size()).size() == 1);
+  CHECK(dispatcher.cache_stats().hits == 2);
+
+  // with one entry, alternating addresses evict each other
+  dispatcher.set_cache_capacity(1);
+  Message second("/mixer/ch/2/level");
+  second.append(2);
+  for (int i = 0; i < 3; i++) {
+    CHECK(dispatcher.match_methods(msg.data(), msg.size()).size() == 2);
+    CHECK(dispatcher.match_methods(second.data(), second.size()).size() == 1);
+  }
+  CHECK(dispatcher.cache_stats().evictions == 5);
+}
+
+TEST(SignatureCacheDecode)
+{
+  using namespace tnyosc;
+  Message msg("/mix");
+  msg.append(7);
+  msg.append('x');
+  msg.append((int64_t)-3);
+  msg.append(0.5f);
+  msg.append("name");
+  msg.append(2.5);
+
+  SignatureCache signatures;
+  std::list<ParsedMessage> plain, cached;
+  CHECK(Dispatcher::decode_data(msg.data(), msg.size(), plain));
+  for (int i = 0; i < 2; ++i) {
+    cached.clear();
+    CHECK(Dispatcher::decode_data(msg.data(), msg.size(), cached,
+          timeval(), NULL, &signatures));
+  }
+  CHECK(signatures.size() == 1);
+  CHECK(signatures.find("ichfsd").slots.size() == 4);
+  CHECK(signatures.find("ichfsd").fixed_size == 4 + 4 + 8 + 4);
+
+  const std::vector<Argument>& a = plain.front().argv;
+  const std::vector<Argument>& b = cached.front().argv;
+  CHECK(a.size() == 6 && b.size() == 6);
+  CHECK(a[0].data.i == 7 && b[0].data.i == 7);
+  CHECK(a[1].data.c == 'x' && b[1].data.c == 'x');
+  CHECK(a[2].data.h == -3 && b[2].data.h == -3);
+  CHECK(a[3].data.f == 0.5f && b[3].data.f == 0.5f);
+  CHECK(strcmp(b[4].data.s, "name") == 0);
+  CHECK(a[5].data.d == 2.5 && b[5].data.d == 2.5);
+
+  // truncated messages are rejected with and without the cache
+  for (size_t size = msg.size() - 4; size > 12; size -= 4) {
+    std::list<ParsedMessage> messages;
+    DecodeError error = kDecodeOk;
+    CHECK(!Dispatcher::decode_data(msg.data(), size, messages, timeval(),
+          &error, &signatures));
+    CHECK(error == kDecodeBadArgument);
+    CHECK(!Dispatcher::decode_data(msg.data(), size, messages));
+  }
+}
+
+TEST(MatchBatchSortsByTimetag)
+{
+  using namespace tnyosc;
+  int sum = 0;
+  Dispatcher dispatcher;
+  dispatcher.add_method("/a", "i", &count_method, &sum);
+  dispatcher.add_method("/*", NULL, &count_method, &sum);
+  dispatcher.add_method("/b", "f", &count_method, &sum);
+
+  Message a("/a");
+  a.append(1);
+  Message b("/b");
+  b.append(10);
+  Bundle late;
+  late.set_timetag(3000000000ULL << 32);
+  late.append(a);
+  late.append(b);
+  Bundle early;
+  early.set_timetag(2900000000ULL << 32);
+  early.append(b);
+
+  std::vector<PacketRef> packets;
+  PacketRef p;
+  p.data = late.data(); p.size = late.size(); packets.push_back(p);
+  p.data = a.data(); p.size = a.size(); packets.push_back(p);
+  p.data = "junk"; p.size = 4; packets.push_back(p);
+  p.data = early.data(); p.size = early.size(); packets.push_back(p);
+  for (int i = 0; i < 50; ++i) {
+    p.data = b.data(); p.size = b.size(); packets.push_back(p);
+  }
+
+  MatchBatch batch;
+  for (int round = 0; round < 2; ++round) {
+    dispatcher.match_batch(&packets[0], packets.size(), batch);
+    CHECK(batch.malformed == 1);
+    CHECK(batch.num_messages == 54);
+    // "/a" matches two methods, "/b" only "/*"
+    CHECK(batch.matches.size() == 56);
+    for (size_t i = 1; i < batch.matches.size(); ++i) {
+      CHECK(batch.matches[i - 1].timetag <= batch.matches[i].timetag);
+    }
+    // immediate messages keep packet order ahead of the bundles
+    CHECK(batch.messages[batch.matches[0].message].address == "/a");
+    CHECK(batch.messages[batch.matches.back().message].address == "/b");
+  }
+  // two distinct addresses, matched once each
+  CHECK(dispatcher.cache_stats().misses == 2);
+
+  for (size_t i = 0; i < batch.matches.size(); ++i) {
+    dispatcher.invoke(batch, batch.matches[i]);
+  }
+  CHECK(sum == 2 * 2 + 52 * 10);
+}
+
+TEST(CompactArgumentsBorrowPacket)
+{
+  using namespace tnyosc;
+  CHECK(sizeof(Argument) <= 16);
+#if __cplusplus >= 201103L
+  static_assert(std::is_trivially_copyable<Argument>::value,
+      "Argument must be trivially copyable");
+#endif
+
+  Message msg("/test1");
+  msg.append(1000);
+  msg.append("test");
+  std::vector<char>* packet =
+    new std::vector<char>(msg.data(), msg.data() + msg.size());
+
+  Dispatcher dispatcher;
+  dispatcher.add_method(TEST1_ADDRESS.c_str(), NULL, &test_method1, NULL);
+  std::list<CallbackRef> callbacks =
+    dispatcher.match_methods(&(*packet)[0], packet->size());
+  // the callback keeps its own copy of the packet
+  memset(&(*packet)[0], 0, packet->size());
+  delete packet;
+
+  CHECK(callbacks.size() == 1);
+  std::vector<Argument> copy = callbacks.front()->argv;
+  CHECK(strcmp(copy[1].data.s, "test") == 0);
+  CHECK(copy[1].data.s >= &(*callbacks.front()->buffer)[0]);
+  dispatcher.invoke(callbacks.front());
+}
+
+TEST(ArrayRoundTrip)
+{
+  using namespace tnyosc;
+  float levels[256];
+  for (int i = 0; i < 256; i++) levels[i] = i * 0.5f;
+  int32_t ids[] = {1, 2, 3};
+
+  Message msg("/meters");
+  msg.append_array(levels, 256);
+  msg.append("tail");
+  msg.begin_array();
+  msg.append_int32s(ids, 3);
+  msg.begin_array();
+  msg.end_array();
+  msg.end_array();
+
+  std::list<ParsedMessage> messages;
+  CHECK(Dispatcher::decode_data(msg.data(), msg.size(), messages));
+  const std::vector<Argument>& argv = messages.front().argv;
+  CHECK(argv.size() == 266);
+  CHECK(argv[2].data.f == 0.5f);
+  CHECK(strcmp(argv[258].data.s, "tail") == 0);
+
+  ArrayView view;
+  CHECK(view.assign(argv, 0));
+  CHECK(view.type == 'f');
+  CHECK(view.count == 256);
+  float out[256];
+  CHECK(view.copy_to(out, 256) == 256);
+  CHECK(memcmp(out, levels, sizeof(levels)) == 0);
+  int32_t wrong[4];
+  CHECK(view.copy_to(wrong, 4) == 0);
+
+  // the second array contains a nested array, so it is not homogeneous
+  CHECK(!view.assign(argv, 259));
+  CHECK(view.assign(argv, 263));
+  CHECK(view.count == 0);
+
+  // copies of the arguments still point into the packet, so they stay valid
+  // after the original argv is gone as long as msg is alive
+  std::vector<Argument> copy = argv;
+  CHECK(copy[258].data.s == argv[258].data.s);
+  messages.clear();
+  CHECK(strcmp(copy[258].data.s, "tail") == 0);
+  CHECK(view.assign(copy, 0));
+  CHECK(view.copy_to(out, 256) == 256);
+  CHECK(out[255] == 127.5f);
+}
+
+TEST(MessageReaderRuns)
+{
+  using namespace tnyosc;
+  float frame[512];
+  for (int i = 0; i < 512; i++) frame[i] = i * 0.25f;
+  double gains[] = {0.5, -1.0};
+
+  Message msg("/spectrum");
+  msg.append(7);
+  msg.append("left");
+  msg.append_floats(frame, 512);
+  msg.append_doubles(gains, 2);
+
+  MessageReader reader;
+  CHECK(reader.parse(msg.data(), msg.size()));
+  CHECK(strcmp(reader.address(), "/spectrum") == 0);
+  CHECK(reader.num_args() == 516);
+  CHECK(reader.run_length(2) == 512);
+
+  int32_t channel;
+  CHECK(reader.read_int32s(0, &channel, 1) == 1);
+  CHECK(channel == 7);
+
+  float out[512];
+  CHECK(reader.read_int32s(2, (int32_t*)out, 512) == 0);
+  CHECK(reader.read_floats(2, out, 512) == 512);
+  CHECK(memcmp(out, frame, sizeof(frame)) == 0);
+
+  double g[2];
+  CHECK(reader.read_doubles(514, g, 2) == 2);
+  CHECK(g[1] == -1.0);
+  // reading backwards rescans from the first argument
+  CHECK(reader.read_floats(100, out, 4) == 4);
+  CHECK(out[0] == 98 * 0.25f);
+
+  // truncated data is rejected
+  CHECK(reader.parse(msg.data(), msg.size() - 8));
+  CHECK(reader.read_doubles(514, g, 2) == 0);
+  Bundle bundle;
+  CHECK(!reader.parse(bundle.data(), bundle.size()));
+}
+
+#if TNYOSC_STATS
+TEST(DispatchStatsCounters)
+{
+  using namespace tnyosc;
+  Message msg("/test1");
+  msg.append(1000);
+  msg.append("test");
+
+  Dispatcher dispatcher;
+  dispatcher.add_method(TEST1_ADDRESS.c_str(), NULL, &test_method1, NULL);
+  dispatcher.add_method("/other", NULL, &test_method1, NULL);
+
+  std::list<CallbackRef> callback_list = 
+    dispatcher.match_methods(msg.data(), msg.size());
+  std::list<CallbackRef>::iterator it = callback_list.begin();
+  for (; it != callback_list.end(); ++it) {
+    dispatcher.invoke(*it);
+  }
+  dispatcher.match_methods("#bundle", 8);
+
+  DispatchStats stats = dispatcher.stats();
+  CHECK(stats.packets == 2);
+  CHECK(stats.messages == 1);
+  CHECK(stats.callbacks == 1);
+  CHECK(stats.decode_errors[kDecodeBadBundle] == 1);
+  CHECK(stats.decode_latency.count == 1);
+  CHECK(stats.handler_latency.count == 1);
+  CHECK(stats.methods.size() == 2);
+  CHECK(stats.methods[0].match_hits == 1);
+  CHECK(stats.methods[1].match_attempts == 1);
+  CHECK(stats.methods[1].match_hits == 0);
+
+  Bundle bundle;
+  dispatcher.publish_stats(bundle);
+  std::list<ParsedMessage> published;
+  CHECK(Dispatcher::decode_data(bundle.data(), bundle.size(), published));
+  CHECK(published.front().address == "/tnyosc/stats/counters");
+
+  dispatcher.reset_stats();
+  CHECK(dispatcher.stats().packets == 0);
+  CHECK(dispatcher.stats().methods[0].match_hits == 0);
+}
+#endif // TNYOSC_STATS
+
 int main()
 {
   return UnitTest::RunAllTests();
@@ -0,0 +1,174 @@
+
+#include "tnyosc-fragment.hpp"
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+struct Completed {
+  int count;
+  std::string address;
+  std::vector<char> data;
+};
+
+void transfer_done(const std::string& address, const char* data, size_t size,
+    void* user_data)
+{
+  Completed* completed = (Completed*)user_data;
+  ++completed->count;
+  completed->address = address;
+  completed->data.assign(data, data + size);
+}
+
+void deliver(tnyosc::Dispatcher& dispatcher, const tnyosc::Message& msg)
+{
+  std::list<tnyosc::CallbackRef> callbacks =
+    dispatcher.match_methods(msg.data(), msg.size());
+  std::list<tnyosc::CallbackRef>::iterator it = callbacks.begin();
+  for (; it != callbacks.end(); ++it) dispatcher.invoke(*it);
+}
+
+TEST(FragmentRoundTrip)
+{
+  using namespace tnyosc;
+  std::vector<char> blob(100003);
+  srand(3);
+  for (size_t i = 0; i < blob.size(); ++i) blob[i] = (char)rand();
+
+  Fragmenter fragmenter(512, 42);
+  std::vector<Message> fragments;
+  CHECK(fragmenter.split("/preset/load", &blob[0], blob.size(), fragments) ==
+      42);
+  size_t chunk = fragmenter.chunk_size("/preset/load");
+  CHECK(fragments.size() == (blob.size() + chunk - 1) / chunk);
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    CHECK(fragments[i].size() <= 512);
+  }
+
+  Completed completed;
+  completed.count = 0;
+  Reassembler reassembler(&transfer_done, &completed);
+  Dispatcher dispatcher;
+  reassembler.attach(dispatcher);
+
+  // out of order, one fragment lost and one duplicated
+  for (size_t i = fragments.size() - 1; i > 0; --i) {
+    std::swap(fragments[i], fragments[rand() % (i + 1)]);
+  }
+  Message lost = fragments.back();
+  fragments.pop_back();
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    deliver(dispatcher, fragments[i]);
+  }
+  deliver(dispatcher, fragments[0]);
+  CHECK(completed.count == 0);
+  CHECK(reassembler.pending() == 1);
+
+  std::vector<std::pair<size_t, size_t> > gaps;
+  CHECK(reassembler.missing("/preset/load", 42, gaps));
+  CHECK(gaps.size() == 1);
+  CHECK(gaps[0].first % chunk == 0);
+  CHECK(gaps[0].second == std::min(gaps[0].first + chunk, blob.size()));
+
+  deliver(dispatcher, lost);
+  CHECK(completed.count == 1);
+  CHECK(completed.address == "/preset/load");
+  CHECK(completed.data == blob);
+  CHECK(reassembler.pending() == 0);
+  CHECK(reassembler.stats().duplicates == 1);
+  CHECK(reassembler.stats().completed == 1);
+  CHECK(reassembler.missing("/preset/load", 42, gaps) == false);
+}
+
+TEST(FragmentTimeoutAndRejects)
+{
+  using namespace tnyosc;
+  Completed completed;
+  completed.count = 0;
+  Reassembler reassembler(&transfer_done, &completed, 1000, 1);
+  Dispatcher dispatcher;
+  reassembler.attach(dispatcher);
+
+  std::vector<char> blob(600, 'x');
+  Fragmenter fragmenter(256, 7);
+  std::vector<Message> fragments;
+  fragmenter.split("/thumb", &blob[0], blob.size(), fragments);
+  deliver(dispatcher, fragments[0]);
+  CHECK(reassembler.pending() == 1);
+  usleep(5000);
+  CHECK(reassembler.expire() == 1);
+  CHECK(reassembler.stats().timed_out == 1);
+
+  // larger than max_transfer_size
+  blob.resize(2000);
+  fragments.clear();
+  fragmenter.split("/thumb", &blob[0], blob.size(), fragments);
+  deliver(dispatcher, fragments[0]);
+  CHECK(reassembler.stats().rejected == 1);
+  CHECK(reassembler.pending() == 0);
+
+  // an empty blob completes with one fragment
+  fragments.clear();
+  fragmenter.split("/thumb", NULL, 0, fragments);
+  CHECK(fragments.size() == 1);
+  deliver(dispatcher, fragments[0]);
+  CHECK(completed.count == 1 && completed.data.empty());
+}
+
+TEST(FragmentSendersWithSameId)
+{
+  using namespace tnyosc;
+  Completed completed;
+  completed.count = 0;
+  Reassembler reassembler(&transfer_done, &completed);
+  Dispatcher a;
+  Dispatcher b;
+  reassembler.attach(a, kFragmentAddress, "10.0.0.1:9000");
+  reassembler.attach(b, kFragmentAddress, "10.0.0.2:9000");
+
+  // two senders using the same ID and size, interleaved
+  std::vector<char> blob_a(1000, 'a');
+  std::vector<char> blob_b(1000, 'b');
+  Fragmenter fragmenter(256, 5);
+  Fragmenter other(256, 5);
+  std::vector<Message> fragments_a;
+  std::vector<Message> fragments_b;
+  fragmenter.split("/preset", &blob_a[0], blob_a.size(), fragments_a);
+  other.split("/preset", &blob_b[0], blob_b.size(), fragments_b);
+  for (size_t i = 0; i < fragments_a.size(); ++i) {
+    deliver(a, fragments_a[i]);
+    if (i + 1 < fragments_b.size()) deliver(b, fragments_b[i]);
+  }
+  CHECK(completed.count == 1);
+  CHECK(completed.data == blob_a);
+  deliver(b, fragments_b.back());
+  CHECK(completed.count == 2);
+  CHECK(completed.data == blob_b);
+
+  // same source and ID, but another address, is another transfer
+  std::vector<Message> thumbs;
+  Fragmenter(256, 5).split("/thumb", &blob_b[0], blob_b.size(), thumbs);
+  deliver(a, fragments_a[0]);
+  deliver(a, thumbs[1]);
+  CHECK(reassembler.pending() == 2);
+  std::vector<std::pair<size_t, size_t> > gaps;
+  CHECK(reassembler.missing("/preset", 5, gaps, "10.0.0.1:9000"));
+  CHECK(!reassembler.missing("/preset", 5, gaps, "10.0.0.2:9000"));
+
+  // default IDs are random, not taken from the clock
+  std::vector<Message> first;
+  std::vector<Message> second;
+  CHECK(Fragmenter().split("/x", "x", 1, first) !=
+      Fragmenter().split("/x", "x", 1, second));
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
@@ -0,0 +1,189 @@
+
+#include "tnyosc-index.hpp"
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <UnitTest++/UnitTest++.h>
+
+#include <sstream>
+
+#include <unistd.h>
+
+TEST(PatternMatchParts)
+{
+  using tnyosc::Dispatcher;
+  CHECK(Dispatcher::pattern_match("/mixer/ch/1/level", "/mixer/ch/*/level"));
+  CHECK(!Dispatcher::pattern_match("/mixer/ch/1/2/level", "/mixer/*/level"));
+  CHECK(!Dispatcher::pattern_match("/a/b", "/*"));
+  CHECK(Dispatcher::pattern_match("/a/b", "/*/*"));
+  CHECK(Dispatcher::pattern_match("/test3", "/test[1-9]"));
+  CHECK(!Dispatcher::pattern_match("/test3", "/test[!1-9]"));
+  CHECK(Dispatcher::pattern_match("/test-", "/test[a-]"));
+  CHECK(Dispatcher::pattern_match("/tests", "/test{,s}"));
+  CHECK(Dispatcher::pattern_match("/test", "/test{,s}"));
+  CHECK(Dispatcher::pattern_match("/abcbc", "/a{bc,b}*c"));
+  CHECK(Dispatcher::pattern_match("/", "/"));
+  CHECK(!Dispatcher::pattern_match("/a", "/"));
+
+  CHECK(Dispatcher::pattern_match("/level", "//level"));
+  CHECK(Dispatcher::pattern_match("/mixer/ch/1/level", "//level"));
+  CHECK(Dispatcher::pattern_match("/mixer/ch/1/level", "/mixer//1//level"));
+  CHECK(Dispatcher::pattern_match("/mixer/ch/1/level", "//ch/*//l?vel"));
+  CHECK(!Dispatcher::pattern_match("/mixer/ch/1/level/x", "//level"));
+  CHECK(!Dispatcher::pattern_match("/mixer/level", "/mixer/ch//level"));
+
+  // would backtrack exponentially without memoization
+  std::string address(200, 'a');
+  CHECK(!Dispatcher::pattern_match("/" + address,
+        "/*a*a*a*a*a*a*a*a*a*a*a*a*b"));
+  std::string deep;
+  std::string pattern;
+  for (int i = 0; i < 60; ++i) {
+    deep += "/a";
+    pattern += "//a";
+  }
+  CHECK(Dispatcher::pattern_match(deep, pattern.substr(1)));
+  CHECK(!Dispatcher::pattern_match(deep, pattern + "//b"));
+}
+
+TEST(MethodIndexMatchesLikePatternMatch)
+{
+  using namespace tnyosc;
+  const char* patterns[] = {
+    "/mixer/ch/1/level", "/mixer/ch/*/level", "/mixer/ch/1/*", "//level",
+    "/mixer//mute", "/mixer/ch/[1-4]/{level,mute}", "/*", "/mixer//ch//*",
+    "//", "/", "", "/mixer/ch/1/level", "/mixer/ch/?/level", "//ch/2"
+  };
+  const char* addresses[] = {
+    "/mixer/ch/1/level", "/mixer/ch/2/level", "/mixer/ch/1/mute", "/level",
+    "/mixer/mute", "/mixer/bus/3/mute", "/mixer", "/mixer/ch/12/level",
+    "/", "", "/mixer/ch/2", "/mixer/ch/1/level/x"
+  };
+  size_t num_patterns = sizeof(patterns) / sizeof(patterns[0]);
+  size_t num_addresses = sizeof(addresses) / sizeof(addresses[0]);
+
+  MethodIndex index;
+  for (size_t i = 0; i < num_patterns; ++i) {
+    CHECK(index.add(patterns[i], "") == i);
+  }
+  for (size_t a = 0; a < num_addresses; ++a) {
+    std::vector<uint32_t> expected;
+    for (size_t i = 0; i < num_patterns; ++i) {
+      if (Dispatcher::pattern_match(addresses[a], patterns[i])) {
+        expected.push_back(i);
+      }
+    }
+    std::vector<uint32_t> found;
+    index.find(addresses[a], found);
+    CHECK(found == expected);
+  }
+
+  std::vector<uint32_t> found;
+  index.find("/mixer/ch/1/level", found);
+  CHECK(found.size() == 8);
+}
+
+void count_method(const std::string& address,
+    const std::vector<tnyosc::Argument>& argv, void* user_data)
+{
+  *(int*)user_data += argv[0].data.i;
+}
+
+TEST(MethodIndexLargeTree)
+{
+  using namespace tnyosc;
+  // 100k methods in a tree four levels deep, plus a few wildcard methods
+  int total = 0;
+  Dispatcher dispatcher;
+  for (int i = 0; i < 100; ++i) {
+    for (int j = 0; j < 100; ++j) {
+      for (int k = 0; k < 10; ++k) {
+        std::ostringstream ss;
+        ss << "/synth/" << i << "/voice/" << j << "/p" << k;
+        dispatcher.add_method(ss.str().c_str(), "i", &count_method, &total);
+      }
+    }
+  }
+  dispatcher.add_method("//p3", "i", &count_method, &total);
+  dispatcher.add_method("/synth/*/voice//p3", "i", &count_method, &total);
+  dispatcher.add_method("/synth/42//*", "i", &count_method, &total);
+  dispatcher.set_cache_capacity(0);
+
+  Message msg("/synth/42/voice/7/p3");
+  msg.append(1);
+  std::list<CallbackRef> callbacks;
+  for (int i = 0; i < 1000; ++i) {
+    callbacks = dispatcher.match_methods(msg.data(), msg.size());
+  }
+  CHECK(callbacks.size() == 4);
+  total = 0;
+  std::list<CallbackRef>::iterator it = callbacks.begin();
+  for (; it != callbacks.end(); ++it) dispatcher.invoke(*it);
+  CHECK(total == 4);
+
+  Message other("/synth/42/voice/7/q");
+  other.append(1);
+  callbacks = dispatcher.match_methods(other.data(), other.size());
+  CHECK(callbacks.size() == 1);
+}
+
+void add_method(const std::string& address,
+    const std::vector<tnyosc::Argument>& argv, void* user_data)
+{
+  *(int*)user_data += 100 * argv[0].data.i;
+}
+
+TEST(DispatcherSnapshot)
+{
+  using namespace tnyosc;
+  const char* path = "/tmp/tnyosc-index_test.snapshot";
+  int total = 0;
+  {
+    Dispatcher dispatcher;
+    for (int i = 0; i < 1000; ++i) {
+      std::ostringstream ss;
+      ss << "/synth/" << i << "/gain";
+      dispatcher.add_method(ss.str().c_str(), "i", &count_method, &total);
+    }
+    dispatcher.add_method("//gain", "f", &count_method, &total);
+    dispatcher.add_method("/synth/{1,2}*/gain", NULL, &count_method, &total);
+    CHECK(dispatcher.save_snapshot(path));
+  }
+
+  std::vector<osc_method> methods(1002, &count_method);
+  std::vector<void*> user_data(1002, &total);
+  methods[1001] = &add_method;
+  Dispatcher dispatcher;
+  CHECK(!dispatcher.load_snapshot(path, &methods[0], &user_data[0], 1001));
+  CHECK(!dispatcher.load_snapshot("/tmp/no-such-snapshot", &methods[0],
+        &user_data[0], 1002));
+  CHECK(dispatcher.load_snapshot(path, &methods[0], &user_data[0], 1002));
+  CHECK(dispatcher.num_methods() == 1002);
+
+  Message msg("/synth/17/gain");
+  msg.append(1);
+  std::list<CallbackRef> callbacks =
+    dispatcher.match_methods(msg.data(), msg.size());
+  CHECK(callbacks.size() == 2);
+  std::list<CallbackRef>::iterator it = callbacks.begin();
+  for (; it != callbacks.end(); ++it) dispatcher.invoke(*it);
+  CHECK(total == 101);
+
+  // copies share the mapped file; adding to a loaded dispatcher copies the
+  // index out of it
+  Dispatcher mapped = dispatcher;
+  dispatcher.add_method("/synth/17/gain", "i", &count_method, &total);
+  Dispatcher copy = dispatcher;
+  callbacks = copy.match_methods(msg.data(), msg.size());
+  CHECK(callbacks.size() == 3);
+  callbacks = dispatcher.match_methods(msg.data(), msg.size());
+  CHECK(callbacks.size() == 3);
+  callbacks = mapped.match_methods(msg.data(), msg.size());
+  CHECK(callbacks.size() == 2);
+  unlink(path);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
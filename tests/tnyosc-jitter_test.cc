@@ -0,0 +1,83 @@
+
+#include "tnyosc-jitter.hpp"
+#include "tnyosc-dispatch.hpp"
+
+#include <list>
+#include <stdlib.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+static tnyosc::CallbackRef make_callback(int64_t timetag_us, int id)
+{
+  tnyosc::CallbackRef callback(new tnyosc::Callback());
+  callback->timetag.tv_sec = timetag_us / 1000000;
+  callback->timetag.tv_usec = timetag_us % 1000000;
+  callback->argv.resize(1);
+  callback->argv[0].type = 'i';
+  callback->argv[0].data.i = id;
+  return callback;
+}
+
+TEST(ClockEstimatorOffsetAndDrift)
+{
+  using namespace tnyosc;
+  ClockEstimator clock(100000, 32);
+  srand(1);
+  // the sender's clock is 5 s behind and runs 100 ppm slow; network delay
+  // is 1 ms plus up to 4 ms of jitter
+  int64_t remote0 = 1000000000000LL;
+  for (int i = 0; i < 3000; ++i) {
+    int64_t remote = remote0 + i * 1000;
+    int64_t local = 5000000 + remote0 + (int64_t)((remote - remote0) * 1.0001)
+      + 1000 + rand() % 4000;
+    clock.add(remote, local);
+  }
+  CHECK(clock.num_bins() == 30);
+  CHECK(clock.drift_ppm() > 80 && clock.drift_ppm() < 120);
+  int64_t remote = remote0 + 3000000;
+  int64_t expected = 5000000 + remote + 300 + 1000;
+  CHECK(llabs(clock.to_local(remote) - expected) < 200);
+}
+
+TEST(JitterBufferReleasesInTimetagOrder)
+{
+  using namespace tnyosc;
+  JitterBuffer buffer(2000, 50000);
+  // remote clock = local clock + 10 s; delay 1 ms with 0..3 ms jitter
+  int64_t skew = 10000000;
+  int delays[] = {1000, 4000, 1500, 1000, 3000, 2500, 1000, 1200};
+  for (int i = 0; i < 8; ++i) {
+    int64_t sent = 1000000 + i * 1000;
+    buffer.push(7, make_callback(sent + skew, i), sent + delays[i]);
+  }
+  // an immediate message passes straight through
+  buffer.push(7, make_callback(0, 100), 1000000);
+  CHECK(buffer.size() == 9);
+
+  std::list<CallbackRef> out;
+  CHECK(buffer.pop(1000000, out) == 1);
+  CHECK(out.front()->argv[0].data.i == 100);
+  out.clear();
+
+  int64_t now = 1000000;
+  while (buffer.size() > 0) {
+    now = buffer.next_release();
+    buffer.pop(now, out);
+  }
+  CHECK(out.size() == 8);
+  int expected = 0;
+  std::list<CallbackRef>::iterator it = out.begin();
+  for (; it != out.end(); ++it) CHECK((*it)->argv[0].data.i == expected++);
+
+  JitterSourceStats stats = buffer.source_stats(7);
+  CHECK(stats.received == 8);
+  CHECK(stats.immediate == 1);
+  CHECK(stats.late == 1); // the 4 ms spike, before the target adapted
+  CHECK(stats.latency_us > 2000 && stats.latency_us <= 5000);
+  CHECK(llabs(stats.offset_us + skew - 1000) < 100);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
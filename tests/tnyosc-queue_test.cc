@@ -0,0 +1,125 @@
+
+#include "tnyosc-queue.hpp"
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <string>
+#include <vector>
+
+#include <UnitTest++/UnitTest++.h>
+
+void log_method(const std::string& address, 
+    const std::vector<tnyosc::Argument>& argv, 
+    void* user_data)
+{
+  std::vector<std::string>* log = (std::vector<std::string>*)user_data;
+  char value[16];
+  snprintf(value, sizeof(value), ":%d", argv[0].data.i);
+  log->push_back(address + value);
+}
+
+void push_message(tnyosc::ReceiveQueue& queue, const char* address, int v)
+{
+  tnyosc::Message msg(address);
+  msg.append(v);
+  queue.push(msg.data(), msg.size());
+}
+
+TEST(ReceiveQueuePriority)
+{
+  using namespace tnyosc;
+  ReceiveQueue queue;
+  size_t meters = queue.add_class(0, 4, kDropOldest);
+  size_t transport = queue.add_class(10, 16, kDropNewest);
+  queue.assign(transport, "/transport/*");
+
+  for (int i = 0; i < 10; ++i) push_message(queue, "/meter/1", i);
+  push_message(queue, "/transport/play", 1);
+
+  std::vector<std::string> log;
+  Dispatcher dispatcher;
+  dispatcher.add_method("/*/*", "i", &log_method, &log);
+  CHECK(queue.size() == 5);
+  CHECK(queue.dispatch(dispatcher, 100) == 5);
+
+  // the critical message jumps the meter backlog; meters kept the newest 4
+  CHECK(log.size() == 5);
+  CHECK(log[0] == "/transport/play:1");
+  CHECK(log[1] == "/meter/1:6");
+  CHECK(log[4] == "/meter/1:9");
+
+  QueueClassStats stats = queue.class_stats(meters);
+  CHECK(stats.enqueued == 10);
+  CHECK(stats.dropped == 6);
+  CHECK(stats.dispatched == 4);
+  CHECK(stats.depth == 0);
+  CHECK(queue.class_stats(transport).dispatched == 1);
+}
+
+TEST(ReceiveQueueDropNewest)
+{
+  using namespace tnyosc;
+  ReceiveQueue queue;
+  queue.add_class(0, 2, kDropNewest);
+  for (int i = 0; i < 5; ++i) push_message(queue, "/a/b", i);
+
+  std::vector<std::string> log;
+  Dispatcher dispatcher;
+  dispatcher.add_method("/a/b", "i", &log_method, &log);
+  queue.dispatch(dispatcher);
+  CHECK(log.size() == 2);
+  CHECK(log[0] == "/a/b:0");
+  CHECK(log[1] == "/a/b:1");
+  CHECK(queue.class_stats(0).dropped == 3);
+}
+
+TEST(ReceiveQueueLatestPerAddress)
+{
+  using namespace tnyosc;
+  ReceiveQueue queue;
+  size_t id = queue.add_class(0, 2, kLatestPerAddress);
+
+  // a bundle of updates collapses to one value per address
+  Bundle bundle;
+  for (int i = 0; i < 5; ++i) {
+    Message a("/fader/1");
+    a.append(i);
+    Message b("/fader/2");
+    b.append(i * 10);
+    bundle.append(a);
+    bundle.append(b);
+  }
+  CHECK(queue.push(bundle.data(), bundle.size()));
+  CHECK(queue.size() == 2);
+  push_message(queue, "/fader/3", 7); // full: drops /fader/1
+
+  std::vector<std::string> log;
+  Dispatcher dispatcher;
+  dispatcher.add_method("/fader/*", "i", &log_method, &log);
+  queue.dispatch(dispatcher);
+  CHECK(log.size() == 2);
+  CHECK(log[0] == "/fader/2:40");
+  CHECK(log[1] == "/fader/3:7");
+
+  QueueClassStats stats = queue.class_stats(id);
+  CHECK(stats.replaced == 8);
+  CHECK(stats.dropped == 1);
+  CHECK(queue.push("junk", 4) == false);
+
+  // a bundle whose second message has no terminated address queues nothing
+  Message fader("/fader/1");
+  fader.append(1);
+  Bundle good;
+  good.append(fader);
+  std::vector<char> bad(good.data(), good.data() + good.size());
+  const char tail[] = {0, 0, 0, 4, '/', 'b', 'a', 'd'};
+  bad.insert(bad.end(), tail, tail + sizeof(tail));
+  CHECK(queue.size() == 0);
+  CHECK(queue.push(&bad[0], bad.size()) == false);
+  CHECK(queue.size() == 0);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
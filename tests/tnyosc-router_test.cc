@@ -0,0 +1,114 @@
+
+#include "tnyosc-router.hpp"
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <list>
+#include <vector>
+
+#include <UnitTest++/UnitTest++.h>
+
+typedef std::vector<tnyosc::ByteArray> PacketList;
+
+void collect_packet(const char* data, size_t size, void* user_data)
+{
+  ((PacketList*)user_data)->push_back(tnyosc::ByteArray(data, data + size));
+}
+
+TEST(RouterForwardsOriginalBytes)
+{
+  using namespace tnyosc;
+  PacketList synths, all;
+  Router router;
+  size_t a = router.add_subscriber(&collect_packet, &synths);
+  size_t b = router.add_subscriber(&collect_packet, &all);
+  router.subscribe(a, "/synth/*");
+  router.subscribe(b, "/*/*");
+  router.subscribe(b, "/synth/freq"); // overlapping pattern
+
+  Message freq("/synth/freq");
+  freq.append(440.0f);
+  Message level("/mixer/level");
+  level.append(0.5f);
+
+  CHECK(router.route(freq.data(), freq.size()));
+  CHECK(router.route(level.data(), level.size()));
+  CHECK(router.route("junk", 4) == false);
+
+  // a lone message is forwarded as is
+  router.flush();
+  CHECK(synths.size() == 1);
+  CHECK(synths[0] == freq.byte_array());
+
+  // several messages are batched into one bundle
+  CHECK(all.size() == 1);
+  std::list<ParsedMessage> messages;
+  CHECK(Dispatcher::decode_data(&all[0][0], all[0].size(), messages));
+  CHECK(messages.size() == 2);
+  CHECK(messages.front().address == "/synth/freq");
+  CHECK(messages.back().address == "/mixer/level");
+
+  CHECK(router.stats().packets == 3);
+  CHECK(router.stats().malformed == 1);
+  CHECK(router.stats().forwarded == 3);
+  CHECK(router.stats().sent == 2);
+}
+
+TEST(RouterKeepsTimetags)
+{
+  using namespace tnyosc;
+  PacketList out;
+  Router router;
+  router.subscribe(router.add_subscriber(&collect_packet, &out), "/a");
+
+  Message msg("/a");
+  msg.append(1);
+  Message other("/b");
+  other.append(2);
+  Bundle timed;
+  timed.set_timetag(12345ULL << 32);
+  timed.append(msg);
+  timed.append(other);
+  timed.append(msg);
+
+  CHECK(router.route(timed.data(), timed.size()));
+  CHECK(router.route(msg.data(), msg.size()));
+  router.flush();
+
+  CHECK(out.size() == 1);
+  std::list<ParsedMessage> messages;
+  CHECK(Dispatcher::decode_data(&out[0][0], out[0].size(), messages));
+  CHECK(messages.size() == 3);
+  std::list<ParsedMessage>::iterator it = messages.begin();
+  CHECK(it->timetag.tv_sec != 0); ++it;
+  CHECK(it->timetag.tv_sec != 0); ++it;
+  CHECK(it->timetag.tv_sec == 0 && it->timetag.tv_usec == 0);
+}
+
+TEST(RouterSplitsAtPacketSize)
+{
+  using namespace tnyosc;
+  PacketList out;
+  Router router(64);
+  router.subscribe(router.add_subscriber(&collect_packet, &out), "/a");
+
+  Message msg("/a");
+  msg.append(1);
+  for (int i = 0; i < 10; ++i) router.route(msg.data(), msg.size());
+  router.flush();
+
+  size_t total = 0;
+  for (size_t i = 0; i < out.size(); ++i) {
+    CHECK(out[i].size() <= 64);
+    std::list<ParsedMessage> messages;
+    CHECK(Dispatcher::decode_data(&out[i][0], out[i].size(), messages));
+    total += messages.size();
+  }
+  CHECK(out.size() > 1);
+  CHECK(total == 10);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
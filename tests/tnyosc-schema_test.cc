@@ -0,0 +1,78 @@
+
+// Build with -std=c++20.
+#include "tnyosc-schema.hpp"
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <UnitTest++/UnitTest++.h>
+
+typedef tnyosc::Schema<"/mixer/ch/level", int32_t, float> Level;
+typedef tnyosc::Schema<"/xy", double, int64_t, float> Position;
+
+static_assert(Level::header_size == 20);
+static_assert(Level::size == 28);
+static_assert(Level::header[16] == ',' && Level::header[18] == 'f');
+
+TEST(SchemaMatchesMessage)
+{
+  tnyosc::Message msg("/mixer/ch/level");
+  msg.append(3);
+  msg.append(0.8f);
+
+  Level::Buffer buf = Level::encode(3, 0.8f);
+  CHECK(msg.size() == Level::size);
+  CHECK(memcmp(msg.data(), buf.data(), Level::size) == 0);
+
+  int32_t ch;
+  float level;
+  CHECK(Level::decode(msg.data(), msg.size(), ch, level));
+  CHECK(ch == 3);
+  CHECK(level == 0.8f);
+}
+
+TEST(SchemaRoundTrip)
+{
+  char buf[Position::size];
+  CHECK(Position::encode(buf, -1.5, 1LL << 40, 2.0f) == Position::size);
+
+  double x;
+  int64_t y;
+  float z;
+  CHECK(Position::decode(buf, sizeof(buf), x, y, z));
+  CHECK(x == -1.5);
+  CHECK(y == 1LL << 40);
+  CHECK(z == 2.0f);
+
+  // the generic decoder agrees
+  std::list<tnyosc::ParsedMessage> messages;
+  CHECK(tnyosc::Dispatcher::decode_data(buf, sizeof(buf), messages));
+  CHECK(messages.front().address == "/xy");
+  CHECK(messages.front().types == "dhf");
+  CHECK(messages.front().argv[1].data.h == 1LL << 40);
+
+  // other schemas and truncated data are rejected
+  int32_t ch;
+  float level;
+  CHECK(!Level::decode(buf, sizeof(buf), ch, level));
+  CHECK(!Position::decode(buf, sizeof(buf) - 4, x, y, z));
+}
+
+#if TNYOSC_RT_AUDIT
+TEST(SchemaDoesNotAllocate)
+{
+  tnyosc::audit_reset();
+  char buf[Level::size];
+  int32_t ch;
+  float level;
+  Level::encode(buf, 1, 0.5f);
+  CHECK(Level::decode(buf, sizeof(buf), ch, level));
+  CHECK(tnyosc::audit_counts("Schema::encode").calls == 1);
+  CHECK(tnyosc::audit_counts("Schema::encode").allocations == 0);
+  CHECK(tnyosc::audit_counts("Schema::decode").allocations == 0);
+}
+#endif // TNYOSC_RT_AUDIT
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
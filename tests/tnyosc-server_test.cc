@@ -0,0 +1,99 @@
+
+#include "tnyosc-server.hpp"
+#include "tnyosc.hpp"
+
+#include <iostream>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+const int NUM_SENDERS = 8;
+const int NUM_PACKETS = 200;
+
+struct Received {
+  pthread_mutex_t mutex;
+  int count;
+  int last_seq[NUM_SENDERS];
+  bool in_order;
+};
+
+void sequence_method(const std::string& address, 
+    const std::vector<tnyosc::Argument>& argv, 
+    void* user_data)
+{
+  Received* received = (Received*)user_data;
+  int sender = argv[0].data.i;
+  int seq = argv[1].data.i;
+  pthread_mutex_lock(&received->mutex);
+  if (seq <= received->last_seq[sender]) received->in_order = false;
+  received->last_seq[sender] = seq;
+  ++received->count;
+  pthread_mutex_unlock(&received->mutex);
+}
+
+TEST(ShardedServerLoopback)
+{
+  using namespace tnyosc;
+  Received received;
+  pthread_mutex_init(&received.mutex, NULL);
+  received.count = 0;
+  received.in_order = true;
+  for (int i = 0; i < NUM_SENDERS; i++) received.last_seq[i] = -1;
+
+  ShardedServer server;
+  server.add_method("/seq", "ii", &sequence_method, &received);
+  CHECK(server.start(0, 4));
+  CHECK(server.num_shards() == 4);
+  CHECK(server.port() != 0);
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(server.port());
+
+  // each sender has its own source port, so the kernel may pick any shard
+  int fds[NUM_SENDERS];
+  for (int i = 0; i < NUM_SENDERS; i++) {
+    fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+  }
+  for (int seq = 0; seq < NUM_PACKETS; seq++) {
+    for (int i = 0; i < NUM_SENDERS; i++) {
+      Message msg("/seq");
+      msg.append(i);
+      msg.append(seq);
+      sendto(fds[i], msg.data(), msg.size(), 0, 
+          (struct sockaddr*)&addr, sizeof(addr));
+    }
+    if (seq % 50 == 0) usleep(1000);
+  }
+
+  for (int wait = 0; wait < 200; wait++) {
+    pthread_mutex_lock(&received.mutex);
+    int count = received.count;
+    pthread_mutex_unlock(&received.mutex);
+    if (count == NUM_SENDERS * NUM_PACKETS) break;
+    usleep(10000);
+  }
+
+  uint64_t packets = 0;
+  for (size_t i = 0; i < server.num_shards(); i++) {
+    ShardStats stats = server.shard_stats(i);
+    std::cerr << "shard " << i << ": " << stats.packets << " packets\n";
+    packets += stats.packets;
+  }
+  server.stop();
+  for (int i = 0; i < NUM_SENDERS; i++) close(fds[i]);
+
+  CHECK(received.count == NUM_SENDERS * NUM_PACKETS);
+  CHECK(packets == (uint64_t)received.count);
+  CHECK(received.in_order);
+  CHECK(server.port() == 0);
+}
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
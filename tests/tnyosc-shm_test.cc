@@ -0,0 +1,147 @@
+
+#include "tnyosc-shm.hpp"
+#include "tnyosc-audit.hpp"
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+const int NUM_WRITERS = 2;
+const int NUM_PACKETS = 5000;
+
+struct Received {
+  int count;
+  int last_seq[NUM_WRITERS];
+  bool in_order;
+};
+
+void sequence_method(const std::string& address, 
+    const std::vector<tnyosc::Argument>& argv, 
+    void* user_data)
+{
+  Received* received = (Received*)user_data;
+  int writer = argv[0].data.i;
+  int seq = argv[1].data.i;
+  if (seq != received->last_seq[writer] + 1) received->in_order = false;
+  received->last_seq[writer] = seq;
+  ++received->count;
+}
+
+TEST(ShmRingSingleProcess)
+{
+  using namespace tnyosc;
+  ShmRing ring;
+  CHECK(ring.create("/tnyosc_shm_test1", 256));
+  CHECK(ring.capacity() == 256);
+
+  Message msg("/a");
+  msg.append(1);
+  size_t written = 0;
+  while (ring.write(msg)) ++written;
+  CHECK(written == 256 / 24); // 8-byte header + 12 bytes padded to 16
+  CHECK(ring.wait(0));
+
+  // wrap around the ring end several times
+  for (int i = 0; i < 100; ++i) {
+    size_t size = 0;
+    const char* packet = ring.peek(&size);
+    CHECK(packet != NULL && size == msg.size());
+    if (packet) CHECK(memcmp(packet, msg.data(), size) == 0);
+    ring.release();
+    CHECK(ring.write(msg));
+  }
+
+  // a packet larger than the ring is refused
+  char big[512] = {0};
+  CHECK(ring.write(big, sizeof(big)) == false);
+
+  ring.close();
+  CHECK(ShmRing::unlink("/tnyosc_shm_test1"));
+}
+
+TEST(ShmRingTwoProcesses)
+{
+  using namespace tnyosc;
+  const char* name = "/tnyosc_shm_test2";
+  ShmRing reader;
+  CHECK(reader.create(name, 4096));
+
+  pid_t pids[NUM_WRITERS];
+  for (int w = 0; w < NUM_WRITERS; ++w) {
+    pids[w] = fork();
+    if (pids[w] == 0) {
+      ShmRing writer;
+      if (!writer.open(name)) _exit(1);
+      for (int i = 0; i < NUM_PACKETS; ++i) {
+        Message msg("/seq");
+        msg.append(w);
+        msg.append(i);
+        while (!writer.write(msg)) sched_yield();
+      }
+      _exit(0);
+    }
+  }
+
+  Received received;
+  received.count = 0;
+  for (int w = 0; w < NUM_WRITERS; ++w) received.last_seq[w] = -1;
+  received.in_order = true;
+  Dispatcher dispatcher;
+  dispatcher.add_method("/seq", "ii", &sequence_method, &received);
+
+  int idle = 0;
+  while (received.count < NUM_WRITERS * NUM_PACKETS && idle < 50) {
+    if (reader.wait(100)) {
+      reader.dispatch(dispatcher);
+      idle = 0;
+    } else {
+      ++idle;
+    }
+  }
+
+  for (int w = 0; w < NUM_WRITERS; ++w) {
+    int status = 0;
+    waitpid(pids[w], &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  CHECK(received.count == NUM_WRITERS * NUM_PACKETS);
+  CHECK(received.in_order);
+  CHECK(ShmRing::unlink(name));
+}
+
+#if TNYOSC_RT_AUDIT
+TEST(ShmRingReserveDoesNotAllocate)
+{
+  using namespace tnyosc;
+  ShmRing ring;
+  CHECK(ring.create("/tnyosc_shm_test3", 256));
+  audit_reset();
+  // wrap around the ring end so that padding records are reserved too
+  for (int i = 0; i < 100; ++i) {
+    char* packet = ring.reserve(12);
+    CHECK(packet != NULL);
+    if (packet == NULL) break;
+    memset(packet, 0, 12);
+    ring.commit(packet);
+    size_t size = 0;
+    CHECK(ring.peek(&size) != NULL);
+    ring.release();
+  }
+  CHECK(audit_counts("ShmRing::reserve").calls == 100);
+  CHECK(audit_counts("ShmRing::reserve").allocations == 0);
+  CHECK(audit_counts("ShmRing::reserve").frees == 0);
+  CHECK(audit_counts("ShmRing::reserve").locks == 0);
+  ring.close();
+  CHECK(ShmRing::unlink("/tnyosc_shm_test3"));
+}
+#endif // TNYOSC_RT_AUDIT
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
@@ -0,0 +1,371 @@
+// Loopback latency and throughput harness.
+//
+// Sends a generated OSC workload from one thread to a receiver thread over
+// loopback UDP or TCP. The receiver runs every packet through a Dispatcher
+// and each handler records the time since the message was built. Results
+// are printed as JSON on stdout.
+//
+//   tnyosc_loopback_bench [--transport udp|tcp] [--count N] [--rate N]
+//       [--addresses N] [--params N] [--wildcards F] [--args TYPES]
+//       [--bundle N] [--depth N]
+//
+// --rate is in packets per second; 0 sends as fast as possible.
+// --addresses and --params size the address tree /bench/gI/pJ.
+// --wildcards is the fraction of groups registered as "/bench/gI/*".
+// --args are the type tags (i, f, h, d, s, b) appended to every message.
+// --bundle puts N messages in each packet; --depth nests each bundle.
+#include "tnyosc-dispatch.hpp"
+#include "tnyosc.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+struct Options {
+  bool tcp;
+  size_t count;
+  double rate;
+  size_t addresses;
+  size_t params;
+  double wildcards;
+  std::string args;
+  size_t bundle;
+  size_t depth;
+
+  Options() : tcp(false), count(100000), rate(0), addresses(16), params(8),
+    wildcards(0.25), args("fffi"), bundle(1), depth(0) {}
+};
+
+struct Results {
+  std::vector<uint64_t> latencies; // ns from build to handler, per message
+  std::vector<char> seen; // by sequence number
+  uint64_t received;
+  uint64_t duplicates;
+  uint64_t packets;
+  uint64_t bytes;
+};
+
+struct Receiver {
+  int fd;
+  bool tcp;
+  size_t expected;
+  tnyosc::Dispatcher dispatcher;
+  Results results;
+  volatile int sender_done;
+};
+
+static uint64_t monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record_method(const std::string& address,
+    const std::vector<tnyosc::Argument>& argv,
+    void* user_data)
+{
+  uint64_t now = monotonic_ns();
+  Results* results = (Results*)user_data;
+  if (argv.size() < 2) return;
+  uint64_t sent = (uint64_t)argv[0].data.h;
+  uint32_t seq = (uint32_t)argv[1].data.i;
+  if (seq < results->seen.size() && results->seen[seq]) {
+    ++results->duplicates;
+    return;
+  }
+  if (seq < results->seen.size()) results->seen[seq] = 1;
+  results->latencies.push_back(now - sent);
+  ++results->received;
+}
+
+static std::string address_of(const Options& opt, size_t n)
+{
+  std::ostringstream ss;
+  ss << "/bench/g" << (n / opt.params) % opt.addresses << "/p"
+    << n % opt.params;
+  return ss.str();
+}
+
+static void add_methods(const Options& opt, tnyosc::Dispatcher& dispatcher,
+    Results* results)
+{
+  size_t wild_groups = (size_t)(opt.wildcards * opt.addresses + 0.5);
+  for (size_t g = 0; g < opt.addresses; ++g) {
+    std::ostringstream ss;
+    ss << "/bench/g" << g << "/";
+    if (g < wild_groups) {
+      dispatcher.add_method((ss.str() + "*").c_str(), NULL, &record_method,
+          results);
+      continue;
+    }
+    for (size_t p = 0; p < opt.params; ++p) {
+      std::ostringstream param;
+      param << ss.str() << "p" << p;
+      dispatcher.add_method(param.str().c_str(), NULL, &record_method,
+          results);
+    }
+  }
+}
+
+static tnyosc::Message build_message(const Options& opt, uint32_t seq)
+{
+  static char blob[16] = {0};
+  tnyosc::Message msg(address_of(opt, seq).c_str());
+  msg.append((int64_t)monotonic_ns());
+  msg.append((int32_t)seq);
+  for (size_t i = 0; i < opt.args.size(); ++i) {
+    switch (opt.args[i]) {
+      case 'i': msg.append((int32_t)i); break;
+      case 'f': msg.append(0.5f * i); break;
+      case 'h': msg.append((int64_t)i); break;
+      case 'd': msg.append(0.25 * i); break;
+      case 's': msg.append("benchmark"); break;
+      case 'b': msg.append_blob(blob, sizeof(blob)); break;
+    }
+  }
+  return msg;
+}
+
+// builds the packet holding messages [seq, seq + opt.bundle)
+static void build_packet(const Options& opt, uint32_t seq, size_t n,
+    tnyosc::ByteArray& packet)
+{
+  if (opt.bundle <= 1 && opt.depth == 0) {
+    packet = build_message(opt, seq).byte_array();
+    return;
+  }
+  tnyosc::Bundle bundle;
+  for (size_t i = 0; i < n; ++i) bundle.append(build_message(opt, seq + i));
+  for (size_t d = 1; d < opt.depth; ++d) {
+    tnyosc::Bundle outer;
+    outer.append(bundle);
+    bundle = outer;
+  }
+  packet = bundle.byte_array();
+}
+
+static bool read_full(int fd, char* data, size_t size)
+{
+  while (size > 0) {
+    ssize_t n = recv(fd, data, size, 0);
+    if (n <= 0) return false;
+    data += n; size -= n;
+  }
+  return true;
+}
+
+static void dispatch(Receiver* r, const char* data, size_t size)
+{
+  ++r->results.packets;
+  r->results.bytes += size;
+  std::list<tnyosc::CallbackRef> callbacks =
+    r->dispatcher.match_methods(data, size);
+  std::list<tnyosc::CallbackRef>::iterator it = callbacks.begin();
+  for (; it != callbacks.end(); ++it) r->dispatcher.invoke(*it);
+}
+
+static void* receiver_main(void* arg)
+{
+  Receiver* r = (Receiver*)arg;
+  std::vector<char> buffer(65536);
+  int idle_ms = 0;
+  while (r->results.received + r->results.duplicates < r->expected) {
+    struct pollfd pfd = { r->fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 10) <= 0) {
+      // after the sender is done, give late packets 500 ms
+      if (__sync_fetch_and_add(&r->sender_done, 0) && (idle_ms += 10) >= 500) {
+        break;
+      }
+      continue;
+    }
+    idle_ms = 0;
+    if (r->tcp) {
+      uint32_t size;
+      if (!read_full(r->fd, (char*)&size, 4)) break;
+      size = ntohl(size);
+      if (size > buffer.size()) buffer.resize(size);
+      if (!read_full(r->fd, &buffer[0], size)) break;
+      dispatch(r, &buffer[0], size);
+    } else {
+      ssize_t n = recv(r->fd, &buffer[0], buffer.size(), 0);
+      if (n > 0) dispatch(r, &buffer[0], n);
+    }
+  }
+  return NULL;
+}
+
+static bool send_packet(int fd, bool tcp, const tnyosc::ByteArray& packet)
+{
+  if (tcp) {
+    uint32_t size = htonl(packet.size());
+    if (send(fd, &size, 4, 0) != 4) return false;
+  }
+  size_t sent = 0;
+  while (sent < packet.size()) {
+    ssize_t n = send(fd, &packet[sent], packet.size() - sent, 0);
+    if (n < 0 && errno == ENOBUFS) continue; // UDP queue full, retry
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+// opens the connected sender and receiver sockets on 127.0.0.1
+static bool open_sockets(bool tcp, int& send_fd, int& recv_fd)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  int type = tcp ? SOCK_STREAM : SOCK_DGRAM;
+
+  int listen_fd = socket(AF_INET, type, 0);
+  if (listen_fd < 0) return false;
+  int rcvbuf = 8 << 20;
+  setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      getsockname(listen_fd, (struct sockaddr*)&addr, &len) != 0 ||
+      (tcp && listen(listen_fd, 1) != 0)) {
+    close(listen_fd);
+    return false;
+  }
+
+  send_fd = socket(AF_INET, type, 0);
+  if (send_fd < 0 || connect(send_fd, (struct sockaddr*)&addr, len) != 0) {
+    close(listen_fd);
+    return false;
+  }
+  if (tcp) {
+    int one = 1;
+    setsockopt(send_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    recv_fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    return recv_fd >= 0;
+  }
+  recv_fd = listen_fd;
+  return true;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double p)
+{
+  if (sorted.empty()) return 0;
+  size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+static bool parse_options(int argc, const char* argv[], Options& opt)
+{
+  for (int i = 1; i < argc; i += 2) {
+    std::string key = argv[i];
+    if (i + 1 >= argc) return false;
+    const char* value = argv[i + 1];
+    if (key == "--transport") opt.tcp = std::string(value) == "tcp";
+    else if (key == "--count") opt.count = strtoul(value, NULL, 10);
+    else if (key == "--rate") opt.rate = atof(value);
+    else if (key == "--addresses") opt.addresses = strtoul(value, NULL, 10);
+    else if (key == "--params") opt.params = strtoul(value, NULL, 10);
+    else if (key == "--wildcards") opt.wildcards = atof(value);
+    else if (key == "--args") opt.args = value;
+    else if (key == "--bundle") opt.bundle = strtoul(value, NULL, 10);
+    else if (key == "--depth") opt.depth = strtoul(value, NULL, 10);
+    else return false;
+  }
+  if (opt.addresses == 0) opt.addresses = 1;
+  if (opt.params == 0) opt.params = 1;
+  if (opt.bundle == 0) opt.bundle = 1;
+  return true;
+}
+
+int main(int argc, const char* argv[])
+{
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    std::cerr << "usage: " << argv[0] << " [--transport udp|tcp] [--count N]"
+      " [--rate N] [--addresses N] [--params N] [--wildcards F]"
+      " [--args TYPES] [--bundle N] [--depth N]\n";
+    return 1;
+  }
+
+  Receiver receiver;
+  int send_fd;
+  if (!open_sockets(opt.tcp, send_fd, receiver.fd)) {
+    std::cerr << "cannot open loopback sockets: " << strerror(errno) << "\n";
+    return 1;
+  }
+  receiver.tcp = opt.tcp;
+  receiver.expected = opt.count;
+  receiver.sender_done = 0;
+  receiver.results.received = 0;
+  receiver.results.duplicates = 0;
+  receiver.results.packets = 0;
+  receiver.results.bytes = 0;
+  receiver.results.seen.assign(opt.count, 0);
+  receiver.results.latencies.reserve(opt.count);
+  add_methods(opt, receiver.dispatcher, &receiver.results);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, &receiver_main, &receiver);
+
+  uint64_t start = monotonic_ns();
+  uint64_t interval = opt.rate > 0 ? (uint64_t)(1e9 / opt.rate) : 0;
+  size_t packets_sent = 0;
+  size_t send_errors = 0;
+  tnyosc::ByteArray packet;
+  for (size_t seq = 0; seq < opt.count; seq += opt.bundle) {
+    if (interval) {
+      uint64_t due = start + packets_sent * interval;
+      while (monotonic_ns() < due) {}
+    }
+    build_packet(opt, seq, std::min(opt.bundle, opt.count - seq), packet);
+    if (!send_packet(send_fd, opt.tcp, packet)) ++send_errors;
+    ++packets_sent;
+  }
+  __sync_fetch_and_add(&receiver.sender_done, 1);
+  pthread_join(thread, NULL);
+  uint64_t end = monotonic_ns();
+  close(send_fd);
+  close(receiver.fd);
+
+  Results& res = receiver.results;
+  std::sort(res.latencies.begin(), res.latencies.end());
+  double elapsed = (end - start) / 1e9;
+  std::cout << "{\"transport\": \"" << (opt.tcp ? "tcp" : "udp") << "\""
+    << ", \"rate\": " << opt.rate
+    << ", \"addresses\": " << opt.addresses * opt.params
+    << ", \"wildcards\": " << opt.wildcards
+    << ", \"args\": \"" << opt.args << "\""
+    << ", \"bundle\": " << opt.bundle
+    << ", \"depth\": " << opt.depth
+    << ", \"messages_sent\": " << opt.count
+    << ", \"packets_sent\": " << packets_sent
+    << ", \"send_errors\": " << send_errors
+    << ", \"messages_received\": " << res.received
+    << ", \"packets_received\": " << res.packets
+    << ", \"dropped\": " << opt.count - res.received
+    << ", \"duplicates\": " << res.duplicates
+    << ", \"elapsed_s\": " << elapsed
+    << ", \"throughput_msgs_per_s\": " << res.received / elapsed
+    << ", \"throughput_bytes_per_s\": " << res.bytes / elapsed
+    << ", \"latency_ns\": {\"p50\": " << percentile(res.latencies, 0.5)
+    << ", \"p99\": " << percentile(res.latencies, 0.99)
+    << ", \"p99.9\": " << percentile(res.latencies, 0.999)
+    << ", \"max\": " << (res.latencies.empty() ? 0 : res.latencies.back())
+    << "}}" << std::endl;
+  return 0;
+}
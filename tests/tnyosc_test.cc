@@ -1,4 +1,6 @@
 #include "tnyosc.hpp"
+#include "tnyosc-coalesce.hpp"
+#include "tnyosc-pack.hpp"
 #include <cstdlib>
 #include <assert.h>
 
@@ -23,7 +25,7 @@ void test_message_data_types()
 {
   std::string test_string = "tnyosc";
   char test_cstring[] = "test";
-  int array[] = {1, 2, 3, 4, 5};
+  int32_t array[] = {1, 2, 3, 4, 5};
 
   tnyosc::Message msg;
   // OSC 1.0 types
@@ -39,11 +41,11 @@ void test_message_data_types()
   msg.append_null();
   msg.append_impulse();
   // nonstandard types
-  msg.append((long long)2);
+  msg.append((int64_t)2);
   msg.append((double)4.0);
   msg.append('!');
   msg.append_midi(1, 0, 0, 255);
-  msg.append_array((void*)array, sizeof(array));
+  msg.append_array(array, 5);
   print_bytes(msg.data(), msg.size());
 }
 
@@ -76,6 +78,60 @@ void test_message_ptr()
   delete msg;
 }
 
+void test_coalescer()
+{
+  // 1 ms window
+  tnyosc::Coalescer coalescer(1000);
+  uint64_t now = tnyosc::get_current_ntp_time();
+
+  for (int i = 0; i < 10; i++) {
+    tnyosc::Message fader("/fader/1");
+    fader.append(i * 0.1f);
+    coalescer.append(fader, now);
+  }
+  tnyosc::Message other("/fader/2");
+  other.append(0.5f);
+  coalescer.append(other, now);
+
+  assert(coalescer.pending() == 2);
+  assert(coalescer.coalesced() == 9);
+  assert(!coalescer.ready(now));
+  assert(coalescer.ready(now + (1ULL << 32) / 100));
+
+  tnyosc::Bundle bundle;
+  assert(coalescer.flush(bundle) == 2);
+  assert(coalescer.pending() == 0);
+  assert(coalescer.flushed() == 2);
+  assert(coalescer.bundles() == 1);
+  print_bytes(bundle.data(), bundle.size());
+}
+
+void test_bundle_packer()
+{
+  tnyosc::BundlePacker packer(300);
+  packer.set_timetag(tnyosc::get_current_ntp_time());
+
+  // 10 messages of 80 bytes each: three fit in a 300-byte bundle
+  for (int i = 0; i < 10; i++) {
+    tnyosc::Message msg("/meter");
+    for (int j = 0; j < 14; j++) msg.append(j);
+    assert(msg.size() == 80);
+    assert(packer.append(msg));
+  }
+  tnyosc::Message big("/big");
+  for (int j = 0; j < 100; j++) big.append(j);
+  assert(!packer.append(big));
+  assert(packer.oversized() == 1);
+
+  std::vector<tnyosc::Bundle> bundles;
+  assert(packer.pack(bundles) == 4);
+  assert(packer.pending() == 0);
+  for (size_t i = 0; i < bundles.size(); i++) {
+    assert(bundles[i].size() <= 300);
+    assert(memcmp(bundles[i].data() + 8, bundles[0].data() + 8, 8) == 0);
+  }
+}
+
 #ifdef TNYOSC_WITH_BOOST
 void test_message_boost_ptr()
 {
@@ -98,6 +154,8 @@ int main(int argc, const char* argv[])
 {
   test_message_data_types(); 
   test_message_ptr();
+  test_coalescer();
+  test_bundle_packer();
   //test_message_large_data();
 #ifdef TNYOSC_WITH_BOOST
   test_message_boost_ptr();